@@ -0,0 +1,176 @@
+#include "clipmap.h"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+Clipmap::Clipmap(unsigned int num_levels, Shader* shader, ComputeShader* generator, NoiseSettings noise_settings, Terrain::DataFormat data_format)
+	: shader(shader), generator(generator), noise_settings(noise_settings), data_format(data_format)
+{
+	levels.resize(std::min(std::max(num_levels, 1u), MAX_LEVELS));
+	for (auto& level : levels) {
+		Terrain::create_data_textures(TEXTURE_SIZE, TEXTURE_SIZE, data_format, level.data_tex, level.biome_tex);
+		// the toroidal addressing is done by hand with texelFetch, plain repeat keeps any filtered read consistent with it
+		for (GLuint tex : { level.data_tex, level.biome_tex })
+			if (tex) {
+				glTextureParameteri(tex, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTextureParameteri(tex, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			}
+	}
+	gen_mesh();
+	std::cout << "Clipmap: " << levels.size() << " levels covering " << get_extent() << " texels, " << get_data_size() / 1024 << " KiB" << std::endl;
+}
+
+Clipmap::~Clipmap()
+{
+	shader = nullptr;
+	generator = nullptr;
+	for (auto& level : levels) {
+		glDeleteTextures(1, &level.data_tex);
+		if (level.biome_tex)
+			glDeleteTextures(1, &level.biome_tex);
+	}
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+}
+
+size_t Clipmap::get_data_size() const
+{
+	return levels.size() * TEXTURE_SIZE * TEXTURE_SIZE * (data_format == Terrain::PACKED ? 4 : 16);
+}
+
+glm::ivec2 Clipmap::window_origin(glm::vec2 eye, unsigned int level)
+{
+	// the eye in samples of the level, the window snapped to an even sample so the next level's samples are on it
+	glm::vec2 samples = eye / (float)(1u << level);
+	return 2 * glm::ivec2(glm::floor(samples * 0.5f)) - GRID_SIZE / 2;
+}
+
+void Clipmap::update(const glm::vec3& eye)
+{
+	this->eye = eye;
+	updated_samples = 0;
+	Terrain::set_generator_uniforms(generator, noise_settings);
+	const glm::ivec2 window(GRID_SIZE + 1);
+	for (unsigned int l = 0; l < levels.size(); l++) {
+		Level& level = levels[l];
+		glm::ivec2 origin = window_origin(glm::vec2(eye.x, eye.z), l);
+		if (level.valid && origin == level.origin)
+			continue;
+		glm::ivec2 shift = origin - level.origin;
+		if (!level.valid || std::abs(shift.x) > GRID_SIZE || std::abs(shift.y) > GRID_SIZE)
+			generate(l, origin, window);
+		else {
+			// the columns that came into view over the whole new window, then the rows
+			if (shift.x != 0)
+				generate(l, glm::ivec2(shift.x > 0 ? level.origin.x + window.x : origin.x, origin.y), glm::ivec2(std::abs(shift.x), window.y));
+			if (shift.y != 0)
+				generate(l, glm::ivec2(origin.x, shift.y > 0 ? level.origin.y + window.y : origin.y), glm::ivec2(window.x, std::abs(shift.y)));
+		}
+		level.origin = origin;
+		level.valid = true;
+	}
+	if (updated_samples > 0)
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void Clipmap::generate(unsigned int level, glm::ivec2 origin, glm::ivec2 count)
+{
+	Terrain::bind_data_images(data_format, levels[level].data_tex, levels[level].biome_tex);
+	generator->setIVec2("grid_origin", origin);
+	generator->setIVec2("grid_count", count);
+	generator->setInt("grid_spacing", 1 << level);
+	glm::ivec3 local_size = generator->getLocalSize();
+	glDispatchCompute((count.x + local_size.x - 1) / local_size.x, (count.y + local_size.y - 1) / local_size.y, 1);
+	updated_samples += (size_t)count.x * count.y;
+}
+
+void Clipmap::set_uniforms(Camera*, glm::mat4 view_projection)
+{
+	shader->use();
+	shader->setMat4("model", view_projection);
+	shader->setFloat("height_scale", height_scale);
+	shader->setFloat("height_shift", height_shift);
+	shader->setInt("grid_size", GRID_SIZE);
+	shader->setInt("texture_size", TEXTURE_SIZE);
+	shader->setInt("terrain_data", 0);
+	shader->setInt("biome_data", 1);
+	shader->setInt("coarse_data", 2);
+	shader->setBool("packed_data", data_format == Terrain::PACKED);
+}
+
+void Clipmap::draw()
+{
+	shader->use();
+	glBindVertexArray(VAO);
+	for (unsigned int l = 0; l < levels.size(); l++) {
+		const Level& level = levels[l];
+		if (!level.valid)
+			continue;
+		bool coarser = l + 1 < levels.size();
+		glBindTextureUnit(0, level.data_tex);
+		// the sampler has to point at a valid texture even when it isn't read
+		glBindTextureUnit(1, data_format == Terrain::PACKED ? level.biome_tex : level.data_tex);
+		glBindTextureUnit(2, levels[coarser ? l + 1 : l].data_tex);
+		shader->setIVec2("level_origin", level.origin);
+		shader->setInt("level_spacing", 1 << l);
+		shader->setBool("blend_coarse", coarser);
+		shader->setVec2("eye_samples", glm::vec2(eye.x, eye.z) / (float)(1u << l));
+
+		if (l == 0) {
+			glDrawElements(GL_TRIANGLES, grid_indices, GL_UNSIGNED_SHORT, nullptr);
+			continue;
+		}
+		// where the finer window sits in this one picks the ring
+		glm::ivec2 hole = levels[l - 1].origin / 2 - level.origin - GRID_SIZE / 4;
+		size_t ring = hole.x + 2 * hole.y;
+		glDrawElements(GL_TRIANGLES, ring_indices, GL_UNSIGNED_SHORT, (void*)((grid_indices + ring * ring_indices) * sizeof(GLushort)));
+	}
+	glBindVertexArray(0);
+}
+
+void Clipmap::gen_mesh()
+{
+	glGenVertexArrays(1, &VAO);
+	glBindVertexArray(VAO);
+
+	// (G + 1)^2 corners, corner (i, j) at i * (G + 1) + j
+	const unsigned int side = GRID_SIZE + 1;
+	std::vector<GLushort> corners;
+	corners.reserve((size_t)side * side * 2);
+	for (unsigned int i = 0; i < side; i++)
+		for (unsigned int j = 0; j < side; j++)
+			corners.insert(corners.end(), { (GLushort)i, (GLushort)j });
+
+	// two triangles per quad, for the whole grid and then for the rings around a hole of G / 2 quads at
+	// (G / 4 + ring % 2, G / 4 + ring / 2)
+	std::vector<GLushort> indices;
+	auto add_quads = [&](int hole_i, int hole_j) {
+		for (int i = 0; i < GRID_SIZE; i++)
+			for (int j = 0; j < GRID_SIZE; j++) {
+				if (i >= hole_i && i < hole_i + GRID_SIZE / 2 && j >= hole_j && j < hole_j + GRID_SIZE / 2)
+					continue;
+				GLushort corner = (GLushort)(i * side + j);
+				indices.insert(indices.end(), { corner, (GLushort)(corner + side), (GLushort)(corner + 1), (GLushort)(corner + 1), (GLushort)(corner + side), (GLushort)(corner + side + 1) });
+			}
+	};
+	add_quads(GRID_SIZE, GRID_SIZE);
+	grid_indices = (GLsizei)indices.size();
+	for (int ring = 0; ring < 4; ring++)
+		add_quads(GRID_SIZE / 4 + ring % 2, GRID_SIZE / 4 + ring / 2);
+	ring_indices = (GLsizei)(indices.size() - grid_indices) / 4;
+
+	glGenBuffers(1, &VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(GLushort), corners.data(), GL_STATIC_DRAW);
+	int grid_location = glGetAttribLocation(shader->ID, "v_grid");
+	glVertexAttribPointer(grid_location, 2, GL_UNSIGNED_SHORT, GL_FALSE, 2 * sizeof(GLushort), (void*)0);
+	glEnableVertexAttribArray(grid_location);
+
+	glGenBuffers(1, &EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
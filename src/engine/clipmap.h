@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include "shader.h"
+#include "compute_shader.h"
+#include "scene_object.h"
+#include "camera.h"
+#include "noise_settings.h"
+#include "terrain.h"
+
+// Geometry clipmaps: nested square grids centred on the camera, for flying over terrain without a fixed extent.
+// Level l samples the noise every 2^l texels over a window of GRID_SIZE x GRID_SIZE quads and keeps the samples in a
+// TEXTURE_SIZE^2 texture addressed toroidally: sample (x, y) of the level lives at texel (x, y) mod TEXTURE_SIZE. When
+// the camera moves the windows slide, and only the newly exposed L-shaped strips are generated, over the samples that
+// left the window. Memory is fixed by the number of levels, and the update cost follows the camera speed.
+//
+// Level 0 draws the whole grid mesh, every coarser level a ring of it around the window of the level below. Windows
+// snap to even samples of their level, which leaves the finer window GRID_SIZE / 4 or GRID_SIZE / 4 + 1 quads in along
+// each axis, so four ring index ranges cover every case. Near its outer border a level blends its heights into the
+// ones of the next coarser level, putting the odd border vertices on the coarse edges so the levels meet without cracks.
+class Clipmap : public SceneObject {
+public:
+	// quads per side of a level window, a multiple of 4 so the finer window starts at a whole quad
+	static const int GRID_SIZE = 248;
+	// texels per side of a level texture, enough for the GRID_SIZE + 1 samples of a window
+	static const int TEXTURE_SIZE = 256;
+	static const unsigned int MAX_LEVELS = 16;
+
+	// keep em public cause its easier to manage
+	float height_scale = 128.0f, height_shift = 64.0f;
+
+	Clipmap(unsigned int num_levels, Shader* shader, ComputeShader* generator, NoiseSettings noise_settings, Terrain::DataFormat data_format = Terrain::FULL);
+	~Clipmap();
+	// slides the level windows to the eye (world xz, in texels) and generates the samples that came into view
+	void update(const glm::vec3& eye);
+	void set_uniforms(Camera* camera, glm::mat4 view_projection);
+	void draw();
+
+	unsigned int get_num_levels() const { return (unsigned int)levels.size(); }
+	// samples generated by the last update()
+	size_t get_updated_samples() const { return updated_samples; }
+	// bytes of GPU memory taken by the level textures, independent of where the camera goes
+	size_t get_data_size() const;
+	// side in texels of the area the coarsest level covers
+	unsigned int get_extent() const { return GRID_SIZE << (levels.size() - 1); }
+
+private:
+	struct Level {
+		GLuint data_tex = 0;
+		GLuint biome_tex = 0;
+		// sample coordinates of the window corner, valid once generated
+		glm::ivec2 origin = glm::ivec2(0);
+		bool valid = false;
+	};
+	std::vector<Level> levels;
+
+	// shader programs
+	Shader* shader = nullptr;
+	ComputeShader* generator = nullptr;
+
+	NoiseSettings noise_settings;
+	Terrain::DataFormat data_format;
+
+	// the (GRID_SIZE + 1)^2 grid mesh, its index buffer holding the whole grid followed by the four rings
+	GLuint VAO = 0;
+	GLuint VBO = 0;
+	GLuint EBO = 0;
+	GLsizei grid_indices = 0;
+	GLsizei ring_indices = 0;
+
+	glm::vec3 eye = glm::vec3(0.0f);
+	size_t updated_samples = 0;
+
+	void gen_mesh();
+	// generates samples [origin, origin + count) of a level; the generator has to be bound with the noise uniforms set
+	void generate(unsigned int level, glm::ivec2 origin, glm::ivec2 count);
+	// window corner of a level for an eye at the given world xz
+	static glm::ivec2 window_origin(glm::vec2 eye, unsigned int level);
+};
@@ -12,6 +12,7 @@
 /// Shader class from https://learnopengl.com
 /// https://learnopengl.com/code_viewer_gh.php?code=includes/learnopengl/shader.h
 /// modified to store the shader on memory, and permit editing and recompilation at runtime
+/// an optional prelude (e.g. "#define LOCAL_SIZE_X 16\n") is injected right after the #version line to compile variants
 
 
 class ComputeShader {
@@ -19,7 +20,7 @@ public:
     unsigned int ID;
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
-    ComputeShader(const char* computePath)
+    ComputeShader(const char* computePath, const std::string& prelude = "")
     {
         // 1. retrieve the compute source code from filePath
         std::string computeCode;
@@ -42,6 +43,12 @@ public:
         {
             std::cout << "ERROR::COMPUTE_SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        if (!prelude.empty())
+        {
+            // #version has to stay the first statement
+            size_t version_end = computeCode.find('\n', computeCode.find("#version"));
+            computeCode.insert(version_end == std::string::npos ? computeCode.size() : version_end + 1, prelude);
+        }
         const char* cShaderCode = computeCode.c_str();
         // 2. compile shaders
         unsigned int compute;
@@ -64,6 +71,14 @@ public:
     {
         glUseProgram(ID);
     }
+    // work group size declared by the shader's layout qualifier
+    // ------------------------------------------------------------------------
+    glm::ivec3 getLocalSize() const
+    {
+        GLint size[3];
+        glGetProgramiv(ID, GL_COMPUTE_WORK_GROUP_SIZE, size);
+        return glm::ivec3(size[0], size[1], size[2]);
+    }
 
     // utility uniform functions
     // ------------------------------------------------------------------------
@@ -90,6 +105,10 @@ public:
     {
         glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
     }
+    void setIVec2(const std::string &name, const glm::ivec2 &value) const
+    {
+        glUniform2iv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     {
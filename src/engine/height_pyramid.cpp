@@ -0,0 +1,132 @@
+#include "height_pyramid.h"
+#include <algorithm>
+#include <cmath>
+
+// range nothing was merged into yet
+static const glm::vec2 EMPTY_RANGE(1e30f, -1e30f);
+
+static glm::vec2 merge(glm::vec2 a, glm::vec2 b)
+{
+	return glm::vec2(std::min(a.x, b.x), std::max(a.y, b.y));
+}
+
+unsigned int HeightPyramid::count_levels(unsigned int width, unsigned int height)
+{
+	unsigned int w = (width + CELL_SIZE - 1) / CELL_SIZE, h = (height + CELL_SIZE - 1) / CELL_SIZE;
+	unsigned int count = 1;
+	while (w > 1 || h > 1) {
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+		count++;
+	}
+	return count;
+}
+
+void HeightPyramid::resize(unsigned int width, unsigned int height)
+{
+	this->width = width;
+	this->height = height;
+	unsigned int count = count_levels(width, height);
+	level_sizes.resize(count);
+	levels.resize(count);
+	glm::uvec2 size((width + CELL_SIZE - 1) / CELL_SIZE, (height + CELL_SIZE - 1) / CELL_SIZE);
+	for (unsigned int level = 0; level < count; level++) {
+		level_sizes[level] = size;
+		levels[level].assign((size_t)size.x * size.y, EMPTY_RANGE);
+		size = (size + 1u) / 2u;
+	}
+}
+
+void HeightPyramid::build(unsigned int width, unsigned int height, const float* heights, size_t texel_stride)
+{
+	resize(width, height);
+	glm::uvec4 all(0, 0, level_sizes[0].x - 1, level_sizes[0].y - 1);
+	reduce_cells(heights, texel_stride, all);
+	propagate(all);
+}
+
+void HeightPyramid::update(const float* heights, size_t texel_stride, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+	if (w == 0 || h == 0)
+		return;
+	glm::uvec4 cells = cells_touched(x, y, w, h);
+	reduce_cells(heights, texel_stride, cells);
+	propagate(cells);
+}
+
+glm::uvec4 HeightPyramid::cells_touched(unsigned int x, unsigned int y, unsigned int w, unsigned int h) const
+{
+	// cell c covers texels [c * CELL_SIZE - 1, (c + 1) * CELL_SIZE], so texel t lands in cells (t - 1) / CELL_SIZE to (t + 1) / CELL_SIZE
+	glm::uvec2 last = level_sizes[0] - 1u;
+	return glm::uvec4(
+		(x > 0 ? x - 1 : 0) / CELL_SIZE,
+		(y > 0 ? y - 1 : 0) / CELL_SIZE,
+		std::min(last.x, (x + w) / CELL_SIZE),
+		std::min(last.y, (y + h) / CELL_SIZE));
+}
+
+void HeightPyramid::reduce_cells(const float* heights, size_t texel_stride, glm::uvec4 cells)
+{
+	size_t row_stride = (size_t)width * texel_stride;
+	for (unsigned int cy = cells.y; cy <= cells.w; cy++) {
+		// texel rows of the cell including its one texel border
+		unsigned int y0 = cy * CELL_SIZE > 0 ? cy * CELL_SIZE - 1 : 0;
+		unsigned int y1 = std::min(height - 1, (cy + 1) * CELL_SIZE);
+		for (unsigned int cx = cells.x; cx <= cells.z; cx++) {
+			unsigned int x0 = cx * CELL_SIZE > 0 ? cx * CELL_SIZE - 1 : 0;
+			unsigned int x1 = std::min(width - 1, (cx + 1) * CELL_SIZE);
+			float lo = heights[y0 * row_stride + x0 * texel_stride], hi = lo;
+			for (unsigned int ty = y0; ty <= y1; ty++) {
+				const float* row = heights + ty * row_stride;
+				for (unsigned int tx = x0; tx <= x1; tx++) {
+					float value = row[tx * texel_stride];
+					lo = std::min(lo, value);
+					hi = std::max(hi, value);
+				}
+			}
+			levels[0][(size_t)cy * level_sizes[0].x + cx] = glm::vec2(lo, hi);
+		}
+	}
+}
+
+void HeightPyramid::propagate(glm::uvec4 cells)
+{
+	for (size_t level = 1; level < levels.size(); level++) {
+		cells /= 2u;
+		glm::uvec2 below_size = level_sizes[level - 1];
+		const std::vector<glm::vec2>& below = levels[level - 1];
+		for (unsigned int cy = cells.y; cy <= cells.w; cy++)
+			for (unsigned int cx = cells.x; cx <= cells.z; cx++) {
+				glm::vec2 range = EMPTY_RANGE;
+				for (unsigned int y = cy * 2; y <= std::min(cy * 2 + 1, below_size.y - 1); y++)
+					for (unsigned int x = cx * 2; x <= std::min(cx * 2 + 1, below_size.x - 1); x++)
+						range = merge(range, below[(size_t)y * below_size.x + x]);
+				levels[level][(size_t)cy * level_sizes[level].x + cx] = range;
+			}
+	}
+}
+
+glm::vec2 HeightPyramid::get_range(float x0, float y0, float x1, float y1) const
+{
+	// level 0 cells overlapping the rectangle
+	glm::uvec2 last = level_sizes[0] - 1u;
+	glm::uvec4 cells(
+		(unsigned int)std::max(0.0f, std::floor(x0 / CELL_SIZE)),
+		(unsigned int)std::max(0.0f, std::floor(y0 / CELL_SIZE)),
+		std::min(last.x, (unsigned int)std::max(0.0f, std::ceil(x1 / CELL_SIZE) - 1.0f)),
+		std::min(last.y, (unsigned int)std::max(0.0f, std::ceil(y1 / CELL_SIZE) - 1.0f)));
+	cells = glm::min(cells, glm::uvec4(last, last));
+	cells.z = std::max(cells.z, cells.x);
+	cells.w = std::max(cells.w, cells.y);
+	// climb until at most 4x4 cells are left to merge, coarser cells only make the range looser
+	unsigned int level = 0;
+	while (level + 1 < levels.size() && (cells.z - cells.x >= 4 || cells.w - cells.y >= 4)) {
+		cells /= 2u;
+		level++;
+	}
+	glm::vec2 range = EMPTY_RANGE;
+	for (unsigned int cy = cells.y; cy <= cells.w; cy++)
+		for (unsigned int cx = cells.x; cx <= cells.z; cx++)
+			range = merge(range, get_cell(level, cx, cy));
+	return range;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+// Min/max mip pyramid (a quadtree of height ranges) over a heightmap.
+// Level 0 stores the (min, max) height of CELL_SIZE x CELL_SIZE texel cells, every further level the range of 2x2 cells
+// of the level below, up to a single cell holding the range of the whole map.
+//
+// Ranges are conservative for the bilinearly filtered heightmap the tessellation evaluation shader samples: a sample
+// anywhere inside a cell mixes texels up to one texel outside of it (clamped to the map edges), so every cell also
+// covers a one texel border. get_range() of any texel-space rectangle therefore bounds every height the renderer can
+// produce over it.
+//
+// Terrain builds it with a GPU reduction pass (shaders/terrain_minmax.comp) and reads the levels back into this class;
+// the CPU generator path builds it directly with build(). Both are incrementally updatable through the same cell
+// rectangles, see cells_touched().
+class HeightPyramid {
+public:
+	// side in texels of the level 0 cells: 8x8 keeps the pyramid at 1/64 of the texel count (8 MiB at 8192x8192)
+	static const unsigned int CELL_SIZE = 8;
+
+	// allocates the levels of a width x height heightmap, with empty ranges
+	void resize(unsigned int width, unsigned int height);
+	// builds all levels from a width x height heightmap; texel_stride is the distance in floats between the heights of
+	// neighbouring texels (NoiseGenerator::NUM_CHANNELS for its RGBA output)
+	void build(unsigned int width, unsigned int height, const float* heights, size_t texel_stride);
+	// recomputes the ranges affected by a change of the w x h texels at (x, y), heights being the full map again
+	void update(const float* heights, size_t texel_stride, unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+	// recomputes levels 1 and up over the given inclusive rectangle of level 0 cells, after they were written directly
+	void propagate(glm::uvec4 cells);
+
+	// inclusive (x0, y0, x1, y1) rectangle of level 0 cells whose ranges depend on the w x h texels at (x, y)
+	glm::uvec4 cells_touched(unsigned int x, unsigned int y, unsigned int w, unsigned int h) const;
+	// conservative (min, max) height over the texel-space rectangle [x0, x1] x [y0, y1]
+	glm::vec2 get_range(float x0, float y0, float x1, float y1) const;
+
+	unsigned int get_num_levels() const { return (unsigned int)levels.size(); }
+	glm::uvec2 get_level_size(unsigned int level) const { return level_sizes[level]; }
+	// row-major (min, max) pairs of a level
+	glm::vec2* get_level_data(unsigned int level) { return levels[level].data(); }
+	const glm::vec2* get_level_data(unsigned int level) const { return levels[level].data(); }
+	glm::vec2 get_cell(unsigned int level, unsigned int x, unsigned int y) const { return levels[level][(size_t)y * level_sizes[level].x + x]; }
+
+	// number of levels a width x height heightmap needs
+	static unsigned int count_levels(unsigned int width, unsigned int height);
+
+private:
+	unsigned int width = 0, height = 0;
+	std::vector<glm::uvec2> level_sizes;
+	std::vector<std::vector<glm::vec2>> levels;
+
+	void reduce_cells(const float* heights, size_t texel_stride, glm::uvec4 cells);
+};
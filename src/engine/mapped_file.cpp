@@ -0,0 +1,130 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path, Access access)
+{
+	close();
+	DWORD flags = access == SEQUENTIAL ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		file = nullptr;
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping != nullptr)
+		data = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		close();
+		return false;
+	}
+	size = (size_t)file_size.QuadPart;
+	return true;
+}
+
+bool MappedFile::create(const std::string& path, size_t size)
+{
+	close();
+	if (size == 0)
+		return false;
+	file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		file = nullptr;
+		return false;
+	}
+	// the mapping extends the file to its size
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, nullptr);
+	if (mapping != nullptr)
+		data = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+	if (data == nullptr) {
+		close();
+		return false;
+	}
+	this->size = size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+	if (file != nullptr)
+		CloseHandle(file);
+	data = nullptr;
+	mapping = nullptr;
+	file = nullptr;
+	size = 0;
+}
+#else
+bool MappedFile::open(const std::string& path, Access access)
+{
+	close();
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close();
+		return false;
+	}
+	void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapped == MAP_FAILED) {
+		close();
+		return false;
+	}
+	data = (unsigned char*)mapped;
+	size = (size_t)info.st_size;
+	madvise(mapped, size, access == SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+	return true;
+}
+
+bool MappedFile::create(const std::string& path, size_t size)
+{
+	close();
+	if (size == 0)
+		return false;
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, (off_t)size) != 0) {
+		close();
+		return false;
+	}
+	void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED) {
+		close();
+		return false;
+	}
+	data = (unsigned char*)mapped;
+	this->size = size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data != nullptr)
+		munmap(data, size);
+	if (fd >= 0)
+		::close(fd);
+	data = nullptr;
+	fd = -1;
+	size = 0;
+}
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Memory mapping of a whole file, read-only or freshly created for writing. Used by TerrainCache to hand cached tiles
+// to the GL straight from the page cache and to write the tiles read back into their files, and by TerrainFile to read
+// its tiles in place.
+class MappedFile {
+public:
+	MappedFile() {}
+	~MappedFile() { close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// how the pages of a file opened for reading will be touched, passed on to the OS read-ahead
+	enum Access {
+		SEQUENTIAL,	// front to back once, like the tiles of a TerrainCache entry
+		RANDOM		// a few scattered regions, like the tiles of a TerrainFile
+	};
+
+	// maps an existing, non-empty file for reading; false if it can't be opened or mapped
+	bool open(const std::string& path, Access access = SEQUENTIAL);
+	// creates the file, or truncates an existing one, at size bytes and maps it for writing
+	bool create(const std::string& path, size_t size);
+	// unmaps and closes the file, written pages are flushed by the OS
+	void close();
+
+	bool is_open() const { return data != nullptr; }
+	const unsigned char* get_data() const { return data; }
+	unsigned char* get_data() { return data; }
+	size_t get_size() const { return size; }
+
+private:
+	unsigned char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	// HANDLEs, kept as void* so the header doesn't pull in windows.h
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
@@ -0,0 +1,138 @@
+#include "noise_generator.h"
+#include <algorithm>
+#include "noise_kernels.h"
+#include "thread_pool.h"
+
+#if defined(NOISE_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// SIMD backends, each compiled in its own translation unit with the matching instruction set enabled
+#ifdef NOISE_X86
+void noise_run_sse41(const NoiseSettings& settings, int x, int y, int count, bool fused, float* out, float* slope);
+void noise_run_avx2(const NoiseSettings& settings, int x, int y, int count, bool fused, float* out, float* slope);
+#endif
+
+static void noise_run_scalar(const NoiseSettings& settings, int x, int y, int count, bool fused, float* out, float* slope)
+{
+	noise::generate_run<float, 1>(settings, x, y, count, fused, out, slope);
+}
+
+NoiseGenerator::NoiseGenerator()
+{
+	select(detect_backend());
+}
+
+NoiseGenerator::NoiseGenerator(Backend backend)
+{
+	select(is_supported(backend) ? backend : detect_backend());
+}
+
+void NoiseGenerator::select(Backend backend)
+{
+	this->backend = backend;
+	switch (backend) {
+#ifdef NOISE_X86
+	case AVX2:
+		run_kernel = noise_run_avx2;
+		break;
+	case SSE41:
+		run_kernel = noise_run_sse41;
+		break;
+#endif
+	default:
+		this->backend = SCALAR;
+		run_kernel = noise_run_scalar;
+		break;
+	}
+}
+
+void NoiseGenerator::generate(const NoiseSettings& settings, unsigned int width, unsigned int height, float* out, float* slope) const
+{
+	generate_region(settings, 0, 0, width, height, out, (size_t)width * NUM_CHANNELS, slope, (size_t)width * 2);
+}
+
+void NoiseGenerator::generate(const NoiseSettings& settings, unsigned int width, unsigned int height, float* out, ThreadPool& pool, float* slope) const
+{
+	unsigned int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	size_t row_stride = (size_t)width * NUM_CHANNELS;
+	pool.parallel_for((size_t)tiles_x * tiles_y, [&](size_t tile) {
+		unsigned int x = (unsigned int)(tile % tiles_x) * TILE_SIZE;
+		unsigned int y = (unsigned int)(tile / tiles_x) * TILE_SIZE;
+		unsigned int w = std::min(TILE_SIZE, width - x);
+		unsigned int h = std::min(TILE_SIZE, height - y);
+		generate_region(settings, x, y, w, h, out + y * row_stride + (size_t)x * NUM_CHANNELS, row_stride,
+			slope ? slope + ((size_t)y * width + x) * 2 : nullptr, (size_t)width * 2);
+	});
+}
+
+void NoiseGenerator::generate_region(const NoiseSettings& settings, int x, int y, unsigned int w, unsigned int h, float* out, size_t row_stride, float* slope, size_t slope_stride) const
+{
+	for (unsigned int row = 0; row < h; row++)
+		run_kernel(settings, x, y + (int)row, (int)w, fused, out + row * row_stride, slope ? slope + row * slope_stride : nullptr);
+}
+
+static float saturate(float value)
+{
+	return value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+}
+
+void NoiseGenerator::pack(const float* rgba, size_t count, uint16_t* height, uint8_t* biome)
+{
+	for (size_t i = 0; i < count; i++) {
+		const float* texel = rgba + i * NUM_CHANNELS;
+		height[i] = (uint16_t)(saturate(texel[0]) * 65535.0f + 0.5f);
+		biome[i * 2] = (uint8_t)(saturate(texel[1]) * 255.0f + 0.5f);
+		biome[i * 2 + 1] = (uint8_t)(saturate(texel[2]) * 255.0f + 0.5f);
+	}
+}
+
+bool NoiseGenerator::is_supported(Backend backend)
+{
+	if (backend == SCALAR)
+		return true;
+#if defined(NOISE_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	if (backend == SSE41)
+		return sse41;
+	// AVX2 also needs the OS to save the ymm registers (OSXSAVE + XCR0 bits 1 and 2)
+	bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+	if (!os_avx || max_leaf < 7)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(NOISE_X86)
+	__builtin_cpu_init();
+	if (backend == SSE41)
+		return __builtin_cpu_supports("sse4.1");
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+NoiseGenerator::Backend NoiseGenerator::detect_backend()
+{
+	if (is_supported(AVX2))
+		return AVX2;
+	if (is_supported(SSE41))
+		return SSE41;
+	return SCALAR;
+}
+
+const char* NoiseGenerator::backend_name(Backend backend)
+{
+	switch (backend) {
+	case AVX2:
+		return "avx2";
+	case SSE41:
+		return "sse4.1";
+	default:
+		return "scalar";
+	}
+}
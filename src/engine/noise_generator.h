@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "noise_settings.h"
+
+class ThreadPool;
+
+// CPU port of shaders/terrain_gen.comp, for generating heightmaps without a GPU (see run_headless in headless.h).
+// Output uses the same layout as the compute shader writes into the RGBA32F terrain texture: row-major texels of
+// (height, moisture, other, 1.0), so a generated buffer can be uploaded as is with glTextureSubImage2D.
+//
+// The noise kernel is implemented once in noise_kernels.h and instantiated for a scalar, an SSE4.1 (4 lanes) and an
+// AVX2 (8 lanes) backend; the fastest one supported by the CPU is picked at runtime. All backends produce bit-identical
+// results. The kernel follows the shader expression by expression, but the output is not compared against the GPU's:
+// the shader compiler is free to order dot products, contract multiply-adds and evaluate pow() its own way, so the two
+// agree closely rather than exactly. The GPU matches only where it samples one texel apart (grid_spacing 1): with
+// NoiseSettings::band_limit, on by default, the octaves are weighted by the sample spacing, so the default output is
+// no longer the plain fbm of the settings wherever an octave comes within half a lattice cell per sample.
+class NoiseGenerator {
+public:
+	enum Backend {
+		SCALAR,
+		SSE41,
+		AVX2
+	};
+
+	static const unsigned int NUM_CHANNELS = 4;
+	// side of the square tiles parallel generation is split into: 64x64 RGBA32F texels are 64 KiB of output, so a tile
+	// stays in the L2 cache of the core producing it. A multiple of every backend's lane count.
+	static const unsigned int TILE_SIZE = 64;
+
+	// evaluate the three channels with the fused fbm kernel instead of three separate fbm calls, same output either way;
+	// only used when the settings have a shared schedule (NoiseSettings::shared_schedule())
+	bool fused = true;
+
+	// picks the best backend supported by the running CPU
+	NoiseGenerator();
+	// forces a backend, falling back to the best supported one if the CPU lacks it
+	explicit NoiseGenerator(Backend backend);
+
+	Backend get_backend() const { return backend; }
+	const char* get_backend_name() const { return backend_name(backend); }
+
+	// generates the full width x height map into out (width * height * NUM_CHANNELS floats), and unless slope is null
+	// the analytic slope of the height (dh/dx, dh/dy per texel) the GPU writes for Terrain into it (width * height * 2
+	// floats)
+	void generate(const NoiseSettings& settings, unsigned int width, unsigned int height, float* out, float* slope = nullptr) const;
+	// same as generate(), splitting the map into TILE_SIZE tiles scheduled on the pool. Every worker writes its tiles
+	// straight into out; since each texel only depends on its coordinates the result is identical for any thread count.
+	void generate(const NoiseSettings& settings, unsigned int width, unsigned int height, float* out, ThreadPool& pool, float* slope = nullptr) const;
+	// generates the w x h block with its top left texel at (x, y), which may lie outside the map on either side (see
+	// TileStreamer); row_stride is the distance in floats between rows of out, slope_stride the one between rows of slope
+	void generate_region(const NoiseSettings& settings, int x, int y, unsigned int w, unsigned int h, float* out, size_t row_stride, float* slope = nullptr, size_t slope_stride = 0) const;
+
+	// converts count RGBA texels to the packed storage of Terrain::PACKED: the height as R16 UNORM and moisture/other as
+	// RG8 UNORM, rounded to nearest and clamped to [0, 1] like the GPU's imageStore conversion
+	static void pack(const float* rgba, size_t count, uint16_t* height, uint8_t* biome);
+
+	static Backend detect_backend();
+	static bool is_supported(Backend backend);
+	static const char* backend_name(Backend backend);
+
+private:
+	typedef void (*RunKernel)(const NoiseSettings& settings, int x, int y, int count, bool fused, float* out, float* slope);
+
+	Backend backend;
+	RunKernel run_kernel;
+
+	void select(Backend backend);
+};
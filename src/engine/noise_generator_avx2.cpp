@@ -0,0 +1,43 @@
+#include "noise_settings.h"
+#include "noise_kernels.h"
+
+// AVX2 backend of NoiseGenerator: 8 texels per lane vector.
+// Needs AVX2 code generation enabled for this file only (see src/CMakeLists.txt).
+#ifdef NOISE_X86
+#include <immintrin.h>
+
+namespace noise { namespace {
+	struct Vec8f {
+		__m256 v;
+		Vec8f() {}
+		Vec8f(__m256 v) : v(v) {}
+		Vec8f(float f) : v(_mm256_set1_ps(f)) {}
+	};
+
+	inline Vec8f operator+(Vec8f a, Vec8f b) { return _mm256_add_ps(a.v, b.v); }
+	inline Vec8f operator-(Vec8f a, Vec8f b) { return _mm256_sub_ps(a.v, b.v); }
+	inline Vec8f operator*(Vec8f a, Vec8f b) { return _mm256_mul_ps(a.v, b.v); }
+	inline Vec8f operator/(Vec8f a, Vec8f b) { return _mm256_div_ps(a.v, b.v); }
+	inline Vec8f operator+(Vec8f a, float b) { return a + Vec8f(b); }
+	inline Vec8f operator-(Vec8f a, float b) { return a - Vec8f(b); }
+	inline Vec8f operator*(Vec8f a, float b) { return a * Vec8f(b); }
+	inline Vec8f operator/(Vec8f a, float b) { return a / Vec8f(b); }
+	inline Vec8f operator+(float a, Vec8f b) { return Vec8f(a) + b; }
+	inline Vec8f operator-(float a, Vec8f b) { return Vec8f(a) - b; }
+	inline Vec8f operator*(float a, Vec8f b) { return Vec8f(a) * b; }
+
+	inline Vec8f lane_floor(Vec8f x) { return _mm256_floor_ps(x.v); }
+	inline Vec8f lane_abs(Vec8f x) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x.v); }
+	inline Vec8f lane_min(Vec8f a, Vec8f b) { return _mm256_min_ps(a.v, b.v); }
+	inline Vec8f lane_max(Vec8f a, Vec8f b) { return _mm256_max_ps(a.v, b.v); }
+	inline Vec8f lane_step(Vec8f edge, Vec8f x) { return _mm256_and_ps(_mm256_cmp_ps(x.v, edge.v, _CMP_GE_OQ), _mm256_set1_ps(1.0f)); }
+	inline Vec8f lane_clamp(Vec8f x, float lo, float hi) { return lane_min(lane_max(x, lo), hi); }
+	inline void lane_load(Vec8f& dst, const float* src) { dst = _mm256_load_ps(src); }
+	inline void lane_store(float* dst, Vec8f x) { _mm256_store_ps(dst, x.v); }
+} }
+
+void noise_run_avx2(const NoiseSettings& settings, int x, int y, int count, bool fused, float* out, float* slope)
+{
+	noise::generate_run<noise::Vec8f, 8>(settings, x, y, count, fused, out, slope);
+}
+#endif
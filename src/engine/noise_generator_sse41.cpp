@@ -0,0 +1,43 @@
+#include "noise_settings.h"
+#include "noise_kernels.h"
+
+// SSE4.1 backend of NoiseGenerator: 4 texels per lane vector.
+// Needs SSE4.1 code generation enabled for this file only (see src/CMakeLists.txt).
+#ifdef NOISE_X86
+#include <smmintrin.h>
+
+namespace noise { namespace {
+	struct Vec4f {
+		__m128 v;
+		Vec4f() {}
+		Vec4f(__m128 v) : v(v) {}
+		Vec4f(float f) : v(_mm_set1_ps(f)) {}
+	};
+
+	inline Vec4f operator+(Vec4f a, Vec4f b) { return _mm_add_ps(a.v, b.v); }
+	inline Vec4f operator-(Vec4f a, Vec4f b) { return _mm_sub_ps(a.v, b.v); }
+	inline Vec4f operator*(Vec4f a, Vec4f b) { return _mm_mul_ps(a.v, b.v); }
+	inline Vec4f operator/(Vec4f a, Vec4f b) { return _mm_div_ps(a.v, b.v); }
+	inline Vec4f operator+(Vec4f a, float b) { return a + Vec4f(b); }
+	inline Vec4f operator-(Vec4f a, float b) { return a - Vec4f(b); }
+	inline Vec4f operator*(Vec4f a, float b) { return a * Vec4f(b); }
+	inline Vec4f operator/(Vec4f a, float b) { return a / Vec4f(b); }
+	inline Vec4f operator+(float a, Vec4f b) { return Vec4f(a) + b; }
+	inline Vec4f operator-(float a, Vec4f b) { return Vec4f(a) - b; }
+	inline Vec4f operator*(float a, Vec4f b) { return Vec4f(a) * b; }
+
+	inline Vec4f lane_floor(Vec4f x) { return _mm_floor_ps(x.v); }
+	inline Vec4f lane_abs(Vec4f x) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), x.v); }
+	inline Vec4f lane_min(Vec4f a, Vec4f b) { return _mm_min_ps(a.v, b.v); }
+	inline Vec4f lane_max(Vec4f a, Vec4f b) { return _mm_max_ps(a.v, b.v); }
+	inline Vec4f lane_step(Vec4f edge, Vec4f x) { return _mm_and_ps(_mm_cmpge_ps(x.v, edge.v), _mm_set1_ps(1.0f)); }
+	inline Vec4f lane_clamp(Vec4f x, float lo, float hi) { return lane_min(lane_max(x, lo), hi); }
+	inline void lane_load(Vec4f& dst, const float* src) { dst = _mm_load_ps(src); }
+	inline void lane_store(float* dst, Vec4f x) { _mm_store_ps(dst, x.v); }
+} }
+
+void noise_run_sse41(const NoiseSettings& settings, int x, int y, int count, bool fused, float* out, float* slope)
+{
+	noise::generate_run<noise::Vec4f, 4>(settings, x, y, count, fused, out, slope);
+}
+#endif
@@ -0,0 +1,337 @@
+#pragma once
+#include <math.h>
+#include "noise_settings.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NOISE_X86 1
+#endif
+
+// Lane-generic port of snoise/fbm from shaders/terrain_gen.comp.
+// Every kernel is written once against a "lane" type V: plain float for the scalar backend, and the SSE/AVX wrappers
+// defined in noise_generator_sse41.cpp / noise_generator_avx2.cpp. Each lane evaluates one texel, so the vec3/vec4
+// components of the GLSL code become separate lane variables. The arithmetic follows the shader expression by
+// expression, which keeps the backends bit-identical to each other and close to the GPU.
+// Everything lives in an unnamed namespace and avoids std:: inline functions: the backends are built with different
+// instruction sets, so no inline copy may be shared between their translation units.
+namespace noise { namespace {
+
+	// scalar lane operations, SIMD lane types provide the same set as overloads found by ADL
+	inline float lane_floor(float x) { return floorf(x); }
+	inline float lane_abs(float x) { return fabsf(x); }
+	inline float lane_min(float a, float b) { return b < a ? b : a; }
+	inline float lane_max(float a, float b) { return a < b ? b : a; }
+	// GLSL step(edge, x)
+	inline float lane_step(float edge, float x) { return x < edge ? 0.0f : 1.0f; }
+	inline float lane_clamp(float x, float lo, float hi) { return lane_min(lane_max(x, lo), hi); }
+	inline void lane_load(float& dst, const float* src) { dst = *src; }
+	inline void lane_store(float* dst, float x) { *dst = x; }
+
+	template <class V> inline V mod289(V x) { return x - lane_floor(x * (1.0f / 289.0f)) * 289.0f; }
+	template <class V> inline V permute(V x) { return mod289(((x * 34.0f) + 10.0f) * x); }
+
+	// Gradient for permutation value p (7x7 points over a square, mapped onto an octahedron), normalised
+	template <class V>
+	inline void gradient(V p, V& g0, V& g1, V& g2)
+	{
+		const float n_ = 0.142857142857f; // 1.0/7.0
+		const float nsx = n_ * 2.0f, nsy = n_ * 0.5f - 1.0f, nsz = n_;
+
+		V j = p - lane_floor(p * nsz * nsz) * 49.0f; // mod(p,7*7)
+		V x_ = lane_floor(j * nsz);
+		V y_ = lane_floor(j - x_ * 7.0f); // mod(j,N)
+		V x = x_ * nsx + nsy;
+		V y = y_ * nsx + nsy;
+		V h = 1.0f - lane_abs(x) - lane_abs(y);
+		V sx = lane_floor(x) * 2.0f + 1.0f;
+		V sy = lane_floor(y) * 2.0f + 1.0f;
+		V sh = 0.0f - lane_step(h, V(0.0f));
+		V gx = x + sx * sh;
+		V gy = y + sy * sh;
+
+		V norm = 1.79284291400159f - 0.85373472095314f * (gx * gx + gy * gy + h * h);
+		g0 = gx * norm;
+		g1 = gy * norm;
+		g2 = h * norm;
+	}
+
+	// Also returns the x and y components of the analytic gradient of the noise at v, as snoise(v, gradient) in
+	// terrain_gen.comp; the value is the same as without
+	template <class V>
+	V snoise(V vx, V vy, V vz, V& dx, V& dy)
+	{
+		const float Cx = 1.0f / 6.0f, Cy = 1.0f / 3.0f;
+
+		// first corner
+		V s = vx * Cy + vy * Cy + vz * Cy;
+		V ix = lane_floor(vx + s), iy = lane_floor(vy + s), iz = lane_floor(vz + s);
+		V t = ix * Cx + iy * Cx + iz * Cx;
+		V x0x = vx - ix + t, x0y = vy - iy + t, x0z = vz - iz + t;
+
+		// other corners
+		V gx = lane_step(x0y, x0x), gy = lane_step(x0z, x0y), gz = lane_step(x0x, x0z);
+		V lx = 1.0f - gx, ly = 1.0f - gy, lz = 1.0f - gz;
+		V i1x = lane_min(gx, lz), i1y = lane_min(gy, lx), i1z = lane_min(gz, ly);
+		V i2x = lane_max(gx, lz), i2y = lane_max(gy, lx), i2z = lane_max(gz, ly);
+
+		V x1x = x0x - i1x + Cx, x1y = x0y - i1y + Cx, x1z = x0z - i1z + Cx;
+		V x2x = x0x - i2x + Cy, x2y = x0y - i2y + Cy, x2z = x0z - i2z + Cy;
+		V x3x = x0x - 0.5f, x3y = x0y - 0.5f, x3z = x0z - 0.5f;
+
+		// permutations
+		ix = mod289(ix); iy = mod289(iy); iz = mod289(iz);
+		V p0 = permute(permute(permute(iz) + iy) + ix);
+		V p1 = permute(permute(permute(iz + i1z) + iy + i1y) + ix + i1x);
+		V p2 = permute(permute(permute(iz + i2z) + iy + i2y) + ix + i2x);
+		V p3 = permute(permute(permute(iz + 1.0f) + iy + 1.0f) + ix + 1.0f);
+
+		// gradients projected onto the corner offsets
+		V g0x, g0y, g0z, g1x, g1y, g1z, g2x, g2y, g2z, g3x, g3y, g3z;
+		gradient(p0, g0x, g0y, g0z);
+		gradient(p1, g1x, g1y, g1z);
+		gradient(p2, g2x, g2y, g2z);
+		gradient(p3, g3x, g3y, g3z);
+		V n0 = g0x * x0x + g0y * x0y + g0z * x0z;
+		V n1 = g1x * x1x + g1y * x1y + g1z * x1z;
+		V n2 = g2x * x2x + g2y * x2y + g2z * x2z;
+		V n3 = g3x * x3x + g3y * x3y + g3z * x3z;
+
+		// mix final noise value
+		V m0 = lane_max(0.5f - (x0x * x0x + x0y * x0y + x0z * x0z), V(0.0f));
+		V m1 = lane_max(0.5f - (x1x * x1x + x1y * x1y + x1z * x1z), V(0.0f));
+		V m2 = lane_max(0.5f - (x2x * x2x + x2y * x2y + x2z * x2z), V(0.0f));
+		V m3 = lane_max(0.5f - (x3x * x3x + x3y * x3y + x3z * x3z), V(0.0f));
+		V q0 = m0 * m0, q1 = m1 * m1, q2 = m2 * m2, q3 = m3 * m3;
+		V f0 = q0 * q0, f1 = q1 * q1, f2 = q2 * q2, f3 = q3 * q3;
+
+		// d/dv of m^4 (g . x) over the corners: -8 m^3 (g . x) x + m^4 g
+		V t0 = q0 * m0 * n0, t1 = q1 * m1 * n1, t2 = q2 * m2 * n2, t3 = q3 * m3 * n3;
+		dx = 105.0f * (-8.0f * (t0 * x0x + t1 * x1x + t2 * x2x + t3 * x3x) + (f0 * g0x + f1 * g1x + f2 * g2x + f3 * g3x));
+		dy = 105.0f * (-8.0f * (t0 * x0y + t1 * x1y + t2 * x2y + t3 * x3y) + (f0 * g0y + f1 * g1y + f2 * g2y + f3 * g3y));
+		return 105.0f * (f0 * n0 + f1 * n1 + f2 * n2 + f3 * n3);
+	}
+
+	// the gradient is optimised away where unused
+	template <class V>
+	inline V snoise(V vx, V vy, V vz)
+	{
+		V dx, dy;
+		return snoise(vx, vy, vz, dx, dy);
+	}
+
+	// Weight of an octave of freq lattice cells per texel at one sample per texel, octave_weight() in terrain_gen.comp:
+	// 1 up to the Nyquist limit of half a cell per sample, smoothly down to 0 at a whole cell per sample
+	inline float octave_weight(float freq, bool band_limit)
+	{
+		if (!band_limit)
+			return 1.0f;
+		float t = lane_clamp((freq - 0.5f) / (1.0f - 0.5f), 0.0f, 1.0f);
+		return 1.0f - t * t * (3.0f - 2.0f * t);
+	}
+
+	// Adds the normalisation of octaves i + 1 .. octaves - 1 to range, for when they are all culled
+	inline float remaining_range(int i, int octaves, float amp, float gain, float range)
+	{
+		for (int j = i + 1; j < octaves; j++) {
+			amp *= gain;
+			range += amp;
+		}
+		return range;
+	}
+
+	template <class V>
+	V fbm(V px, V py, V pz, float freq, int octaves, float amp, float lacunarity, float gain, float range, bool band_limit)
+	{
+		V value = (amp * octave_weight(freq, band_limit)) * snoise(px * freq, py * freq, pz * freq);
+		for (int i = 1; i < octaves; i++) {
+			freq *= lacunarity;
+			amp *= gain;
+			range += amp;
+			float weight = octave_weight(freq, band_limit);
+			// the later octaves are finer still and only count towards the normalisation
+			if (weight == 0.0f && lacunarity > 1.0f) {
+				range = remaining_range(i, octaves, amp, gain, range);
+				break;
+			}
+			if (weight > 0.0f)
+				value = value + (amp * weight) * snoise(px * freq, py * freq, pz * freq);
+		}
+		// scales back to [-1.0, 1.0] interval, then normalize to [0, 1]
+		value = lane_clamp(value / range, -1.0f, 1.0f);
+		return (value + 1.0f) * 0.5f;
+	}
+
+	// fbm() along with its slope over the texels, fbm_grad() in terrain_gen.comp: px and py move with them, so each
+	// octave adds its noise gradient scaled by its weight and frequency, followed through the normalisation and the clamp
+	template <class V>
+	V fbm_grad(V px, V py, V pz, float freq, int octaves, float amp, float lacunarity, float gain, float range, bool band_limit, V& slope_x, V& slope_y)
+	{
+		V dx, dy;
+		float weight = octave_weight(freq, band_limit);
+		V value = (amp * weight) * snoise(px * freq, py * freq, pz * freq, dx, dy);
+		slope_x = (amp * weight * freq) * dx;
+		slope_y = (amp * weight * freq) * dy;
+		for (int i = 1; i < octaves; i++) {
+			freq *= lacunarity;
+			amp *= gain;
+			range += amp;
+			weight = octave_weight(freq, band_limit);
+			if (weight == 0.0f && lacunarity > 1.0f) {
+				range = remaining_range(i, octaves, amp, gain, range);
+				break;
+			}
+			if (weight > 0.0f) {
+				value = value + (amp * weight) * snoise(px * freq, py * freq, pz * freq, dx, dy);
+				slope_x = slope_x + (amp * weight * freq) * dx;
+				slope_y = slope_y + (amp * weight * freq) * dy;
+			}
+		}
+		value = value / range;
+		// flat where the clamp cuts the value off
+		V unclamped = lane_step(lane_abs(value), V(1.0f));
+		slope_x = slope_x / range * unclamped * 0.5f;
+		slope_y = slope_y / range * unclamped * 0.5f;
+		value = lane_clamp(value, -1.0f, 1.0f);
+		return (value + 1.0f) * 0.5f;
+	}
+
+	// Fused fbm of the three channels: one loop walks the frequency/amplitude schedule and accumulates the normalisation
+	// range once, and each octave evaluates the three snoise calls side by side so their independent dependency chains
+	// interleave. Channel c samples point c at frequency freq * freq_scale[c]. Bit-identical to three fbm() calls.
+	// With band_limit each channel drops out on its own frequency, the loop ends once all of them have. With slope the
+	// slope of channel 0 is accumulated as in fbm_grad().
+	template <class V>
+	void fbm3(const V (&px)[3], const V (&py)[3], const V (&pz)[3], const float (&freq_scale)[3], float freq, int octaves, float amp, float lacunarity, float gain, float range, bool band_limit, V (&value)[3], V* slope = nullptr)
+	{
+		// gradient of channel 0's last octave
+		V dx, dy;
+		for (int c = 0; c < 3; c++) {
+			float f = freq * freq_scale[c];
+			float a = amp * octave_weight(f, band_limit);
+			value[c] = a * (c == 0 ? snoise(px[c] * f, py[c] * f, pz[c] * f, dx, dy) : snoise(px[c] * f, py[c] * f, pz[c] * f));
+			if (c == 0 && slope) {
+				slope[0] = (a * f) * dx;
+				slope[1] = (a * f) * dy;
+			}
+		}
+		for (int i = 1; i < octaves; i++) {
+			freq *= lacunarity;
+			amp *= gain;
+			range += amp;
+			float weight[3];
+			bool any = false;
+			for (int c = 0; c < 3; c++) {
+				weight[c] = octave_weight(freq * freq_scale[c], band_limit);
+				any = any || weight[c] > 0.0f;
+			}
+			if (!any && lacunarity > 1.0f) {
+				range = remaining_range(i, octaves, amp, gain, range);
+				break;
+			}
+			if (weight[0] > 0.0f && weight[1] > 0.0f && weight[2] > 0.0f) {
+				V n0 = snoise(px[0] * (freq * freq_scale[0]), py[0] * (freq * freq_scale[0]), pz[0] * (freq * freq_scale[0]), dx, dy);
+				V n1 = snoise(px[1] * (freq * freq_scale[1]), py[1] * (freq * freq_scale[1]), pz[1] * (freq * freq_scale[1]));
+				V n2 = snoise(px[2] * (freq * freq_scale[2]), py[2] * (freq * freq_scale[2]), pz[2] * (freq * freq_scale[2]));
+				value[0] = value[0] + (amp * weight[0]) * n0;
+				value[1] = value[1] + (amp * weight[1]) * n1;
+				value[2] = value[2] + (amp * weight[2]) * n2;
+			}
+			else {
+				for (int c = 0; c < 3; c++) {
+					if (weight[c] == 0.0f)
+						continue;
+					float f = freq * freq_scale[c];
+					V n = c == 0 ? snoise(px[c] * f, py[c] * f, pz[c] * f, dx, dy) : snoise(px[c] * f, py[c] * f, pz[c] * f);
+					value[c] = value[c] + (amp * weight[c]) * n;
+				}
+			}
+			if (slope && weight[0] > 0.0f) {
+				float a = amp * weight[0] * (freq * freq_scale[0]);
+				slope[0] = slope[0] + a * dx;
+				slope[1] = slope[1] + a * dy;
+			}
+		}
+		for (int c = 0; c < 3; c++)
+			value[c] = value[c] / range;
+		if (slope) {
+			// flat where the clamp cuts the value off
+			V unclamped = lane_step(lane_abs(value[0]), V(1.0f));
+			slope[0] = slope[0] / range * unclamped * 0.5f;
+			slope[1] = slope[1] / range * unclamped * 0.5f;
+		}
+		for (int c = 0; c < 3; c++)
+			value[c] = (lane_clamp(value[c], -1.0f, 1.0f) + 1.0f) * 0.5f;
+	}
+
+	// Evaluates LANES consecutive texels of row y starting at column x, matching main() in terrain_gen.comp.
+	// iota holds the lane indices 0..LANES-1. fused selects fbm3() over three separate fbm() calls, when the height and
+	// biome settings share their schedule. With slope the slope of the height, as stored, goes to slope[0..1].
+	template <class V>
+	void texel_channels(const NoiseSettings& s, V iota, int x, int y, bool fused, V& height, V& moisture, V& other, V* slope = nullptr)
+	{
+		V px = iota + (float)x;
+		V py = V((float)y);
+		// the fused loop needs every channel on the same schedule
+		if (fused && s.shared_schedule()) {
+			const V cx[3] = { px + s.offset.x, px + 0.0f, px + 64.0f };
+			const V cy[3] = { py + s.offset.y, py + 16.0f, py + 64.0f };
+			const V cz[3] = { V(s.offset.z), V(32.0f), V(64.0f) };
+			const float freq_scale[3] = { 1.0f, 1.0f, 2.0f };
+			V value[3];
+			fbm3(cx, cy, cz, freq_scale, s.frequency, s.octaves, s.amplitude, s.lacunarity, s.gain, s.range, s.band_limit, value, slope);
+			height = value[0];
+			moisture = value[1];
+			other = value[2];
+		}
+		else {
+			if (slope)
+				height = fbm_grad(px + s.offset.x, py + s.offset.y, V(s.offset.z), s.frequency, s.octaves, s.amplitude, s.lacunarity, s.gain, s.range, s.band_limit, slope[0], slope[1]);
+			else
+				height = fbm(px + s.offset.x, py + s.offset.y, V(s.offset.z), s.frequency, s.octaves, s.amplitude, s.lacunarity, s.gain, s.range, s.band_limit);
+			moisture = fbm(px + 0.0f, py + 16.0f, V(32.0f), s.biome_frequency, s.biome_octaves, s.biome_amplitude, s.biome_lacunarity, s.biome_gain, s.biome_range, s.band_limit);
+			other = fbm(px + 64.0f, py + 64.0f, V(64.0f), s.biome_frequency * 2.0f, s.biome_octaves, s.biome_amplitude, s.biome_lacunarity, s.biome_gain, s.biome_range, s.band_limit);
+		}
+		// chain rule through the squaring
+		if (slope) {
+			slope[0] = slope[0] * (2.0f * height);
+			slope[1] = slope[1] * (2.0f * height);
+		}
+		height = height * height;
+	}
+
+	// Writes count RGBA texels of row y starting at column x to out, LANES texels at a time, and their (dh/dx, dh/dy)
+	// to slope unless it is null. Lanes past the end of the run are evaluated but discarded.
+	template <class V, int LANES>
+	void generate_run(const NoiseSettings& s, int x, int y, int count, bool fused, float* out, float* slope)
+	{
+		alignas(32) float lanes[LANES];
+		for (int k = 0; k < LANES; k++)
+			lanes[k] = (float)k;
+		V iota;
+		lane_load(iota, lanes);
+
+		alignas(32) float h[LANES], m[LANES], o[LANES], sx[LANES], sy[LANES];
+		for (int i = 0; i < count; i += LANES) {
+			V vh, vm, vo, vs[2];
+			texel_channels(s, iota, x + i, y, fused, vh, vm, vo, slope ? vs : nullptr);
+			lane_store(h, vh);
+			lane_store(m, vm);
+			lane_store(o, vo);
+			int n = count - i < LANES ? count - i : LANES;
+			if (slope) {
+				lane_store(sx, vs[0]);
+				lane_store(sy, vs[1]);
+				for (int k = 0; k < n; k++) {
+					slope[(size_t)(i + k) * 2] = sx[k];
+					slope[(size_t)(i + k) * 2 + 1] = sy[k];
+				}
+			}
+			for (int k = 0; k < n; k++) {
+				float* texel = out + (size_t)(i + k) * 4;
+				texel[0] = h[k];
+				texel[1] = m[k];
+				texel[2] = o[k];
+				texel[3] = 1.0f;
+			}
+		}
+	}
+} }
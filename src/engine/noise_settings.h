@@ -0,0 +1,48 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// Parameters of the fbm noise used to generate the terrain, shared by the GPU generator (shaders/terrain_gen.comp)
+// and the CPU port in noise_generator.h
+struct NoiseSettings {
+	// height channel
+	glm::vec3 offset;
+	float frequency;
+	int octaves;
+	float amplitude;
+	float lacunarity;
+	float gain;
+	float range;
+	// moisture and detail channels, the detail sampling at twice the frequency; they are not moved by the offset
+	float biome_frequency;
+	int biome_octaves;
+	float biome_amplitude;
+	float biome_lacunarity;
+	float biome_gain;
+	float biome_range;
+	// fade out the octaves finer than the sample spacing can resolve instead of letting them alias; at one sample per
+	// texel this only touches octaves above half a lattice cell per texel
+	bool band_limit = true;
+
+	// the biome channels start out with the height channel's parameters
+	NoiseSettings(glm::vec3 offset, float frequency, int octaves, float amplitude, float lacunarity, float gain, float range)
+		: offset(offset), frequency(frequency), octaves(octaves), amplitude(amplitude), lacunarity(lacunarity), gain(gain), range(range),
+		biome_frequency(frequency), biome_octaves(octaves), biome_amplitude(amplitude), biome_lacunarity(lacunarity), biome_gain(gain), biome_range(range) {};
+
+	// settings the application starts with
+	static NoiseSettings defaults() { return NoiseSettings(glm::vec3(0), 0.0025f, 8, 4.0f, 2.0f, 0.575f, 0.65f); }
+
+	// the parameters of the height channel but its offset, and of the biome channels, are the same
+	bool same_height_shape(const NoiseSettings& other) const {
+		return band_limit == other.band_limit && frequency == other.frequency && octaves == other.octaves && amplitude == other.amplitude && lacunarity == other.lacunarity && gain == other.gain && range == other.range;
+	}
+	bool same_biome(const NoiseSettings& other) const {
+		return band_limit == other.band_limit && biome_frequency == other.biome_frequency && biome_octaves == other.biome_octaves && biome_amplitude == other.biome_amplitude
+			&& biome_lacunarity == other.biome_lacunarity && biome_gain == other.biome_gain && biome_range == other.biome_range;
+	}
+	bool operator==(const NoiseSettings& other) const { return offset == other.offset && same_height_shape(other) && same_biome(other); }
+	bool operator!=(const NoiseSettings& other) const { return !(*this == other); }
+	// every channel walks the same frequency/amplitude schedule, so the generators can evaluate them in one fused loop
+	bool shared_schedule() const {
+		return biome_frequency == frequency && biome_octaves == octaves && biome_amplitude == amplitude && biome_lacunarity == lacunarity && biome_gain == gain && biome_range == range;
+	}
+};
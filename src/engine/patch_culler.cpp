@@ -0,0 +1,190 @@
+#include "patch_culler.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULL_SSE2
+#include <emmintrin.h>
+#endif
+
+static const unsigned int ALL_PLANES = (1u << Frustum::NUM_PLANES) - 1;
+
+void PatchCuller::set_bounds(unsigned int resolution, unsigned int num_levels, const NodeBounds& node_bounds)
+{
+	this->resolution = resolution;
+	size_t count = (size_t)resolution * resolution;
+	size_t padded = (count + 3) & ~(size_t)3;
+	for (auto array : { &center_x, &center_y, &center_z, &extent_x, &extent_y, &extent_z })
+		array->assign(padded, 0.0f);
+	// NaN centers fail every comparison, so the padding never counts as visible
+	for (size_t i = count; i < padded; i++)
+		center_x[i] = center_y[i] = center_z[i] = NAN;
+
+	level_sides.resize(num_levels);
+	node_centers.resize(num_levels);
+	node_extents.resize(num_levels);
+	for (unsigned int level = 0; level < num_levels; level++) {
+		unsigned int side = (resolution + (1u << level) - 1) >> level;
+		level_sides[level] = side;
+		node_centers[level].resize((size_t)side * side);
+		node_extents[level].resize((size_t)side * side);
+		for (unsigned int i = 0; i < side; i++)
+			for (unsigned int j = 0; j < side; j++) {
+				AABB bounds = node_bounds(level, i, j);
+				size_t node = (size_t)i * side + j;
+				node_centers[level][node] = bounds.get_center();
+				node_extents[level][node] = bounds.get_extents();
+				if (level == 0) {
+					center_x[node] = node_centers[0][node].x;
+					center_y[node] = node_centers[0][node].y;
+					center_z[node] = node_centers[0][node].z;
+					extent_x[node] = node_extents[0][node].x;
+					extent_y[node] = node_extents[0][node].y;
+					extent_z[node] = node_extents[0][node].z;
+				}
+			}
+	}
+}
+
+void PatchCuller::add_run(std::vector<Run>& visible, unsigned int first, unsigned int count)
+{
+	if (!visible.empty() && visible.back().first + visible.back().count == first)
+		visible.back().count += count;
+	else
+		visible.push_back({ first, count });
+}
+
+void PatchCuller::cull_flat(const Frustum& frustum, std::vector<Run>& visible) const
+{
+	visible.clear();
+	const glm::vec4* planes = frustum.planes;
+	size_t count = (size_t)resolution * resolution;
+#ifdef CULL_SSE2
+	__m128 nx[Frustum::NUM_PLANES], ny[Frustum::NUM_PLANES], nz[Frustum::NUM_PLANES], d[Frustum::NUM_PLANES];
+	__m128 ax[Frustum::NUM_PLANES], ay[Frustum::NUM_PLANES], az[Frustum::NUM_PLANES];
+	for (int p = 0; p < Frustum::NUM_PLANES; p++) {
+		nx[p] = _mm_set1_ps(planes[p].x);
+		ny[p] = _mm_set1_ps(planes[p].y);
+		nz[p] = _mm_set1_ps(planes[p].z);
+		d[p] = _mm_set1_ps(planes[p].w);
+		ax[p] = _mm_set1_ps(std::fabs(planes[p].x));
+		ay[p] = _mm_set1_ps(std::fabs(planes[p].y));
+		az[p] = _mm_set1_ps(std::fabs(planes[p].z));
+	}
+	for (size_t i = 0; i < count; i += 4) {
+		__m128 cx = _mm_loadu_ps(&center_x[i]), cy = _mm_loadu_ps(&center_y[i]), cz = _mm_loadu_ps(&center_z[i]);
+		__m128 ex = _mm_loadu_ps(&extent_x[i]), ey = _mm_loadu_ps(&extent_y[i]), ez = _mm_loadu_ps(&extent_z[i]);
+		int mask = 0xF;
+		for (int p = 0; p < Frustum::NUM_PLANES && mask; p++) {
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), d[p]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+			mask &= _mm_movemask_ps(_mm_cmpge_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()));
+		}
+		for (int lane = 0; lane < 4; lane++)
+			if (mask & (1 << lane))
+				add_run(visible, (unsigned int)(i + lane), 1);
+	}
+#else
+	for (size_t i = 0; i < count; i++) {
+		bool inside = true;
+		for (int p = 0; p < Frustum::NUM_PLANES && inside; p++) {
+			float dist = planes[p].x * center_x[i] + planes[p].y * center_y[i] + planes[p].z * center_z[i] + planes[p].w;
+			float radius = std::fabs(planes[p].x) * extent_x[i] + std::fabs(planes[p].y) * extent_y[i] + std::fabs(planes[p].z) * extent_z[i];
+			inside = dist + radius >= 0.0f;
+		}
+		if (inside)
+			add_run(visible, (unsigned int)i, 1);
+	}
+#endif
+}
+
+void PatchCuller::cull_quadtree(const Frustum& frustum, std::vector<Run>& visible) const
+{
+	visible.clear();
+	nodes_tested = 0;
+	if (!level_sides.empty())
+		cull_node(frustum, (unsigned int)level_sides.size() - 1, 0, 0, ALL_PLANES, visible);
+}
+
+void PatchCuller::cull_node(const Frustum& frustum, unsigned int level, unsigned int i, unsigned int j, unsigned int plane_mask, std::vector<Run>& visible) const
+{
+	unsigned int side = level_sides[level];
+	if (i >= side || j >= side)
+		return;
+	nodes_tested++;
+	if (outside_frustum(frustum, level, (size_t)i * side + j, plane_mask))
+		return;
+
+	if (plane_mask == 0 || level == 0) {
+		// accept the whole subtree: one run per grid row it covers
+		unsigned int first_i = i << level, end_i = std::min(resolution, (i + 1) << level);
+		unsigned int first_j = j << level, end_j = std::min(resolution, (j + 1) << level);
+		for (unsigned int row = first_i; row < end_i; row++)
+			add_run(visible, row * resolution + first_j, end_j - first_j);
+		return;
+	}
+	for (unsigned int child = 0; child < 4; child++)
+		cull_node(frustum, level - 1, i * 2 + (child >> 1), j * 2 + (child & 1), plane_mask, visible);
+}
+
+bool PatchCuller::outside_frustum(const Frustum& frustum, unsigned int level, size_t node, unsigned int& plane_mask) const
+{
+	glm::vec3 center = node_centers[level][node], extent = node_extents[level][node];
+	for (int p = 0; p < Frustum::NUM_PLANES; p++) {
+		if (!(plane_mask & (1u << p)))
+			continue;
+		const glm::vec4& plane = frustum.planes[p];
+		float dist = glm::dot(glm::vec3(plane), center) + plane.w;
+		float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+		if (dist + radius < 0.0f)
+			return true;
+		// completely in front, the children don't need to test this plane again
+		if (dist - radius >= 0.0f)
+			plane_mask &= ~(1u << p);
+	}
+	return false;
+}
+
+float PatchCuller::distance_to(const glm::vec3& point, unsigned int level, size_t node) const
+{
+	glm::vec3 outside = glm::max(glm::abs(point - node_centers[level][node]) - node_extents[level][node], glm::vec3(0.0f));
+	return glm::length(outside);
+}
+
+void PatchCuller::select_lod(const Frustum& frustum, const glm::vec3& eye, const std::vector<float>& ranges, std::vector<LodNode>& selected) const
+{
+	selected.clear();
+	nodes_tested = 0;
+	if (!level_sides.empty())
+		select_node(frustum, eye, ranges, (unsigned int)level_sides.size() - 1, 0, 0, ALL_PLANES, selected);
+}
+
+bool PatchCuller::select_node(const Frustum& frustum, const glm::vec3& eye, const std::vector<float>& ranges, unsigned int level, unsigned int i, unsigned int j, unsigned int plane_mask, std::vector<LodNode>& selected) const
+{
+	unsigned int side = level_sides[level];
+	// past the grid edge of a non power of two grid: nothing to draw
+	if (i >= side || j >= side)
+		return true;
+	nodes_tested++;
+	size_t node = (size_t)i * side + j;
+	float distance = distance_to(eye, level, node);
+	bool root = level + 1 == level_sides.size();
+	if (!root && distance > ranges[level])
+		return false;
+	if (outside_frustum(frustum, level, node, plane_mask))
+		return true;
+
+	if (level == 0 || distance > ranges[level - 1]) {
+		selected.push_back({ level, i, j });
+		return true;
+	}
+	for (unsigned int child = 0; child < 4; child++) {
+		unsigned int child_i = i * 2 + (child >> 1), child_j = j * 2 + (child & 1);
+		if (select_node(frustum, eye, ranges, level - 1, child_i, child_j, plane_mask, selected))
+			continue;
+		unsigned int child_mask = plane_mask;
+		if (!outside_frustum(frustum, level - 1, (size_t)child_i * level_sides[level - 1] + child_j, child_mask))
+			selected.push_back({ level - 1, child_i, child_j });
+	}
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include "../utils/aabb.h"
+#include "../utils/frustum.h"
+
+// Frustum culling of the terrain patches on the CPU.
+// Patches form a resolution x resolution grid, patch (i, j) having index i * resolution + j. The result is a list of
+// runs of consecutive visible indices, which map one to one onto indirect draw commands.
+//
+// cull_flat() tests every patch: the patch bounds are kept as structure of arrays (centers and half extents, one array
+// per axis) so four boxes are tested per instruction with SSE2, the baseline of every x86-64 CPU, and plain scalar code
+// elsewhere. A box is culled when it lies completely behind one of the planes, using the center/extent form of the
+// p-vertex test: dot(n, center) + d + dot(|n|, extent) < 0.
+//
+// cull_quadtree() walks a quadtree over the grid instead, node (i, j) of level l covering 2^l x 2^l patches. A node
+// completely in front of a plane passes that plane on to its children as already satisfied (the plane mask), and a node
+// in front of all six planes accepts its whole subtree as a few runs without testing it. Only nodes straddling the
+// frustum boundary get descended into, so the cost follows the boundary instead of the patch count.
+//
+// select_lod() walks the same quadtree to pick the nodes of a CDLOD (continuous distance-dependent LOD) renderer: every
+// level l has a range, a node is split into its children while it overlaps the range of the level below, and the
+// visible nodes that are not split are selected to be drawn whole, finer levels near the eye and coarser ones far away.
+class PatchCuller {
+public:
+	struct Run {
+		unsigned int first;
+		unsigned int count;
+	};
+	// quadtree node (i, j) of a level
+	struct LodNode {
+		unsigned int level;
+		unsigned int i;
+		unsigned int j;
+	};
+
+	// bounds of node (i, j) of a level, level 0 being the patches
+	typedef std::function<AABB(unsigned int level, unsigned int i, unsigned int j)> NodeBounds;
+
+	// replaces the bounds of a resolution x resolution patch grid with num_levels quadtree levels
+	void set_bounds(unsigned int resolution, unsigned int num_levels, const NodeBounds& node_bounds);
+	unsigned int get_num_patches() const { return resolution * resolution; }
+
+	// both clear visible and fill it with the runs of patches that intersect the frustum, in ascending order for
+	// cull_flat() and in traversal order for cull_quadtree()
+	void cull_flat(const Frustum& frustum, std::vector<Run>& visible) const;
+	void cull_quadtree(const Frustum& frustum, std::vector<Run>& visible) const;
+
+	// clears selected and fills it with the visible nodes to draw for an eye at the given position. ranges[l] is the
+	// distance up to which level l is used, increasing with l; the root is always used however far it is. A node beyond
+	// its range whose parent was split is selected anyway: every point of it lies beyond the range, which is what the
+	// renderer needs to morph it completely into the coarser level
+	void select_lod(const Frustum& frustum, const glm::vec3& eye, const std::vector<float>& ranges, std::vector<LodNode>& selected) const;
+	unsigned int get_num_levels() const { return (unsigned int)level_sides.size(); }
+
+	// visiting statistics of the last cull_quadtree() or select_lod() call
+	unsigned int get_nodes_tested() const { return nodes_tested; }
+
+private:
+	unsigned int resolution = 0;
+	// patch bounds, padded to a multiple of four with boxes that are never visible
+	std::vector<float> center_x, center_y, center_z;
+	std::vector<float> extent_x, extent_y, extent_z;
+	// per quadtree level: nodes per side and (center, extent) of every node, row i * level side + j
+	std::vector<unsigned int> level_sides;
+	std::vector<std::vector<glm::vec3>> node_centers, node_extents;
+	mutable unsigned int nodes_tested = 0;
+
+	void cull_node(const Frustum& frustum, unsigned int level, unsigned int i, unsigned int j, unsigned int plane_mask, std::vector<Run>& visible) const;
+	// false when the node lies beyond ranges[level] and has to be selected by its parent
+	bool select_node(const Frustum& frustum, const glm::vec3& eye, const std::vector<float>& ranges, unsigned int level, unsigned int i, unsigned int j, unsigned int plane_mask, std::vector<LodNode>& selected) const;
+	// true when the node is completely behind one of the planes in plane_mask, otherwise removes the planes the node is
+	// completely in front of from plane_mask
+	bool outside_frustum(const Frustum& frustum, unsigned int level, size_t node, unsigned int& plane_mask) const;
+	// distance from point to the bounds of the node, 0 inside
+	float distance_to(const glm::vec3& point, unsigned int level, size_t node) const;
+	// adds patches [first, first + count) to visible, extending the last run when they are contiguous
+	static void add_run(std::vector<Run>& visible, unsigned int first, unsigned int count);
+};
@@ -1,11 +1,41 @@
 #include "terrain.h"
+#include "terrain_cache.h"
 #include <iostream>
+#include <chrono>
+#include <cstring>
 
-Terrain::Terrain(unsigned int width, unsigned int height, unsigned int resolution, Shader* shader, ComputeShader* generator, NoiseSettings noise_settings)
-	: width(width) ,height(height), resolution(resolution), shader(shader), generator(generator), noise_settings(noise_settings){
-	gen_data();
-	gen_vertices();
-	std::cout << "Loaded vertices: " << vertices.size() / 3 << " for a total of " << vertices.size() * sizeof(float) * 3 << " bytes." << std::endl;
+constexpr float Terrain::PACKED_HEIGHT_ERROR;
+
+static GLuint create_data_texture(unsigned int width, unsigned int height, GLenum internal_format)
+{
+	GLuint tex;
+	glCreateTextures(GL_TEXTURE_2D, 1, &tex);
+	glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// clamped, so the border patches don't blend in heights from the opposite edge
+	glTextureParameteri(tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureStorage2D(tex, 1, internal_format, width, height);
+	return tex;
+}
+
+Terrain::Terrain(unsigned int width, unsigned int height, unsigned int resolution, Shader* shader, Shader* cdlod_shader, ComputeShader* generator, ComputeShader* bounds_reducer, ComputeShader* roughness_estimator, ComputeShader* tess_estimator, NoiseSettings noise_settings, DataFormat data_format, bool deferred, const Terrain* previous, TerrainCache* cache)
+	: shader(shader), cdlod_shader(cdlod_shader), generator(generator), bounds_reducer(bounds_reducer), roughness_estimator(roughness_estimator), tess_estimator(tess_estimator), width(width), height(height), resolution(resolution), data_format(data_format), noise_settings(noise_settings), cache(cache){
+	if (deferred) {
+		create_data_textures(width, height, data_format, data_tex, biome_tex);
+		slope_tex = create_data_texture(width, height, GL_RG16F);
+		data_cached = cache != nullptr && cache->contains(cache->make_key(noise_settings, width, height, data_format));
+		if (!data_cached)
+			reuse_data(previous);
+		create_bounds_textures();
+		create_roughness_buffer();
+		build_stage = BUILD_DATA;
+		return;
+	}
+	gen_data(previous);
+	gen_bounds();
+	gen_roughness();
+	gen_tess_buffers();
 
 	// LEGACY: no tessellation
 	//gen_indices();
@@ -17,18 +47,423 @@ Terrain::~Terrain()
 {
 	std::cout << "Deleting terrain" << std::endl;
 	shader = nullptr;
+	cdlod_shader = nullptr;
 	generator = nullptr;
+	bounds_reducer = nullptr;
+	roughness_estimator = nullptr;
+	tess_estimator = nullptr;
 	glDeleteTextures(1, &data_tex);
+	glDeleteTextures(1, &slope_tex);
+	glDeleteTextures((GLsizei)bounds_textures.size(), bounds_textures.data());
+	if (biome_tex)
+		glDeleteTextures(1, &biome_tex);
+	glDeleteTextures(1, &preview_tex);
+	glDeleteTextures(1, &preview_biome_tex);
+	glDeleteTextures(1, &preview_slope_tex);
+	for (auto& timer : refine_timers)
+		free_refine_queries.push_back(timer.query);
+	glDeleteQueries((GLsizei)free_refine_queries.size(), free_refine_queries.data());
 	glBindVertexArray(0);
 	glDeleteVertexArrays(1, &VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+	glDeleteVertexArrays(1, &cdlod_VAO);
+	glDeleteBuffers(1, &cdlod_VBO);
+	glDeleteBuffers(1, &cdlod_EBO);
+	glDeleteBuffers(1, &cdlod_instance_buffer);
+	glDeleteBuffers(1, &indirect_buffer);
+	glDeleteBuffers(1, &roughness_buffer);
+	glDeleteBuffers(1, &tess_factor_buffer);
+	glDeleteBuffers(1, &patch_range_buffer);
+	glDeleteQueries(1, &triangle_query);
+}
+
+unsigned int Terrain::get_build_units(BuildStage stage) const
+{
+	switch (stage) {
+	case BUILD_DATA:
+		return height;
+	case BUILD_BOUNDS:
+		return height_pyramid.get_level_size(0).y;
+	case BUILD_ROUGHNESS:
+		return get_num_patches();
+	case BUILD_BUFFERS:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+float Terrain::get_build_progress() const
+{
+	if (build_stage == BUILD_DONE)
+		return 1.0f;
+	return ((float)build_stage + (float)build_progress / get_build_units(build_stage)) / (float)BUILD_DONE;
+}
+
+bool Terrain::build(double budget_ms)
+{
+	if (build_stage == BUILD_DONE)
+		return true;
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed_ms = [&start]() { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+	for (unsigned int slices = 0; build_stage != BUILD_DONE; slices++) {
+		// as many units as the time left allows at the last measured cost, one to measure a stage's first slice
+		unsigned int remaining = get_build_units(build_stage) - build_progress;
+		double unit_ms = build_unit_ms[build_stage];
+		double left_ms = budget_ms - elapsed_ms();
+		if (slices > 0 && left_ms < unit_ms)
+			break;
+		unsigned int count = unit_ms > 0.0 ? (unsigned int)std::min((double)remaining, std::max(left_ms / unit_ms, 1.0)) : 1;
+
+		auto slice_start = std::chrono::steady_clock::now();
+		count = build_slice(count);
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		std::chrono::duration<double, std::milli> slice_ms = std::chrono::steady_clock::now() - slice_start;
+		build_unit_ms[build_stage] = slice_ms.count() / count;
+
+		build_progress += count;
+		if (build_progress == get_build_units(build_stage)) {
+			build_stage = (BuildStage)(build_stage + 1);
+			build_progress = 0;
+		}
+	}
+	build_frames++;
+	build_ms += elapsed_ms();
+	if (build_stage == BUILD_DONE)
+		std::cout << "Built terrain over " << build_frames << " frames, " << build_ms << " ms, " << get_data_size() / (1024 * 1024) << " MiB" << std::endl;
+	return build_stage == BUILD_DONE;
+}
+
+unsigned int Terrain::build_slice(unsigned int count)
+{
+	unsigned int first = build_progress;
+	switch (build_stage) {
+	case BUILD_DATA:
+		// an entry found damaged is removed, the rows are generated from then on
+		if (data_cached)
+			data_cached = load_cached(glm::uvec2(0, first), glm::uvec2(width, count));
+		if (!data_cached)
+			generate_rows(first, count);
+		if (first + count == height) {
+			glMemoryBarrier(GL_ALL_BARRIER_BITS);
+			if (!data_cached)
+				store_cached();
+		}
+		break;
+	case BUILD_BOUNDS:
+		reduce_bounds(glm::uvec4(0, first, height_pyramid.get_level_size(0).x - 1, first + count - 1));
+		break;
+	case BUILD_ROUGHNESS:
+		// patches in row order: whole rows, or the rest of the current one
+		if (first % resolution == 0 && count >= resolution) {
+			count -= count % resolution;
+			estimate_roughness(glm::uvec2(0, first / resolution), glm::uvec2(resolution, count / resolution));
+		}
+		else {
+			count = std::min(count, resolution - first % resolution);
+			estimate_roughness(glm::uvec2(first % resolution, first / resolution), glm::uvec2(count, 1));
+		}
+		break;
+	case BUILD_BUFFERS:
+		gen_tess_buffers();
+		gen_buffers();
+		break;
+	default:
+		break;
+	}
+	return count;
+}
+
+unsigned int Terrain::changed_channels(const NoiseSettings& from, const NoiseSettings& to)
+{
+	unsigned int changed = 0;
+	if (from.offset != to.offset || !from.same_height_shape(to))
+		changed |= HEIGHT_CHANNEL;
+	if (!from.same_biome(to))
+		changed |= BIOME_CHANNEL;
+	return changed;
+}
+
+void Terrain::regenerate(const NoiseSettings& settings)
+{
+	unsigned int changed = changed_channels(noise_settings, settings);
+	bool offset_only = changed == HEIGHT_CHANNEL && noise_settings.same_height_shape(settings);
+	glm::vec3 offset_delta = settings.offset - noise_settings.offset;
+	noise_settings = settings;
+	if (!is_built()) {
+		// the block of the previous terrain has the old settings
+		reused = glm::uvec2(0);
+		height_shifted = false;
+		data_cached = cache != nullptr && cache->contains(cache->make_key(noise_settings, width, height, data_format));
+		build_stage = BUILD_DATA;
+		build_progress = 0;
+		return;
+	}
+	if (changed == 0)
+		return;
+
+	// sample (x, y) is the noise at (x, y) + offset, so a whole-texel offset change just moves the heights; with
+	// fractional offsets the shifted heights can differ from generated ones by the rounding of the noise position
+	glm::ivec2 delta(offset_delta.x, offset_delta.y);
+	bool whole_texels = glm::vec2(delta) == glm::vec2(offset_delta.x, offset_delta.y) && offset_delta.z == 0.0f;
+	if (offset_only && whole_texels && refine_tiles.empty()
+		&& (unsigned int)std::abs(delta.x) < width && (unsigned int)std::abs(delta.y) < height) {
+		shift_height(delta);
+		return;
+	}
+
+	// a cached map is loaded by the refinement instead of generated, a tile per refine tile and every channel of it
+	data_cached = cache != nullptr && cache->contains(cache->make_key(noise_settings, width, height, data_format));
+	if (data_cached)
+		changed = ALL_CHANNELS;
+
+	// tiles still being refined for an earlier change need every channel of it too
+	if (!refine_tiles.empty())
+		changed |= refine_channels;
+	refine_channels = changed;
+	if (data_format == PACKED || changed == ALL_CHANNELS) {
+		gen_preview();
+		if (changed & HEIGHT_CHANNEL) {
+			glm::uvec2 cells = height_pyramid.get_level_size(0);
+			reduce_bounds(glm::uvec4(0, 0, cells.x - 1, cells.y - 1));
+			culler_dirty = true;
+			upload_patch_ranges();
+			// the stretched preview is smooth between its samples, a few per patch side see all there is to see
+			int samples = (int)(std::max(width, height) / (preview_spacing * resolution));
+			estimate_roughness(glm::uvec2(0), glm::uvec2(resolution), std::max(samples, 1));
+		}
+	}
+
+	refine_tiles.clear();
+	for (unsigned int y = 0; y < height; y += REFINE_TILE_SIZE)
+		for (unsigned int x = 0; x < width; x += REFINE_TILE_SIZE)
+			refine_tiles.emplace_back(x, y);
+	refine_total = (unsigned int)refine_tiles.size();
+}
+
+void Terrain::shift_height(glm::ivec2 delta)
+{
+	// the texels kept, at their new place
+	glm::ivec2 kept_origin = glm::max(-delta, glm::ivec2(0));
+	glm::ivec2 kept_size = glm::ivec2(width, height) - glm::abs(delta);
+	auto shift = [&](GLuint& tex, GLenum internal_format) {
+		GLuint shifted = create_data_texture(width, height, internal_format);
+		glCopyImageSubData(tex, GL_TEXTURE_2D, 0, kept_origin.x + delta.x, kept_origin.y + delta.y, 0,
+			shifted, GL_TEXTURE_2D, 0, kept_origin.x, kept_origin.y, 0, kept_size.x, kept_size.y, 1);
+		glDeleteTextures(1, &tex);
+		tex = shifted;
+	};
+	shift(data_tex, data_format == PACKED ? GL_R16 : GL_RGBA32F);
+	shift(slope_tex, GL_RG16F);
+	height_shifted = true;
+
+	// the exposed columns over the whole height, then the exposed rows between them; FULL storage moved the biome
+	// channels along, they are generated again over the rest
+	glm::uvec2 exposed[2][2] = {
+		{ glm::uvec2(delta.x > 0 ? kept_size.x : 0, 0), glm::uvec2(std::abs(delta.x), height) },
+		{ glm::uvec2(kept_origin.x, delta.y > 0 ? kept_size.y : 0), glm::uvec2(kept_size.x, std::abs(delta.y)) }
+	};
+	unsigned int exposed_channels = data_format == PACKED ? HEIGHT_CHANNEL : ALL_CHANNELS;
+	for (auto& region : exposed)
+		if (region[1].x > 0 && region[1].y > 0)
+			generate_region(region[0], region[1], exposed_channels);
+	if (data_format == FULL)
+		generate_region(glm::uvec2(kept_origin), glm::uvec2(kept_size), BIOME_CHANNEL);
+	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+
+	glm::uvec2 cells = height_pyramid.get_level_size(0);
+	reduce_bounds(glm::uvec4(0, 0, cells.x - 1, cells.y - 1));
+	culler_dirty = true;
+	upload_patch_ranges();
+
+	// a shift by whole patches moves their roughness along, otherwise every patch samples different heights
+	glm::uvec2 patch_texels = glm::uvec2(width, height) / resolution;
+	bool whole_patches = width % resolution == 0 && height % resolution == 0
+		&& delta.x % (int)patch_texels.x == 0 && delta.y % (int)patch_texels.y == 0;
+	if (!whole_patches) {
+		estimate_roughness(glm::uvec2(0), glm::uvec2(resolution));
+		return;
+	}
+	glm::ivec2 patch_delta = delta / glm::ivec2(patch_texels);
+	glm::ivec2 kept_first = glm::max(-patch_delta, glm::ivec2(0));
+	glm::ivec2 kept_count = glm::ivec2(resolution) - glm::abs(patch_delta);
+	GLuint moved = roughness_buffer;
+	create_roughness_buffer();
+	// patch (i, j) at i * resolution + j: a run of kept_count.y patches per kept i
+	GLsizeiptr stride = ROUGHNESS_STRIDE * sizeof(float);
+	for (int i = kept_first.x; i < kept_first.x + kept_count.x; i++)
+		glCopyNamedBufferSubData(moved, roughness_buffer, ((i + patch_delta.x) * (GLintptr)resolution + kept_first.y + patch_delta.y) * stride,
+			(i * (GLintptr)resolution + kept_first.y) * stride, kept_count.y * stride);
+	glDeleteBuffers(1, &moved);
+	for (auto& region : exposed)
+		if (region[1].x > 0 && region[1].y > 0)
+			update_roughness(region[0], region[1]);
+	// and the patches now on the border the heights moved towards, which sample the clamped edge instead of a neighbour
+	if (delta.x != 0)
+		update_roughness(glm::uvec2(delta.x > 0 ? 0 : width - 1, 0), glm::uvec2(1, height));
+	if (delta.y != 0)
+		update_roughness(glm::uvec2(0, delta.y > 0 ? 0 : height - 1), glm::uvec2(width, 1));
+}
+
+void Terrain::gen_preview()
+{
+	if (!preview_tex) {
+		// sample s of the preview is texel s * preview_spacing of the heightmap, one more past the far edges so the
+		// stretched preview covers them
+		preview_spacing = std::max(1u, (std::max(width, height) + PREVIEW_SIZE - 1) / PREVIEW_SIZE);
+		preview_size = (glm::uvec2(width, height) - 1u) / preview_spacing + 2u;
+		create_data_textures(preview_size.x, preview_size.y, data_format, preview_tex, preview_biome_tex);
+		preview_slope_tex = create_data_texture(preview_size.x, preview_size.y, GL_RG16F);
+	}
+	bind_data_images(data_format, preview_tex, preview_biome_tex);
+	set_generator_uniforms(generator, noise_settings);
+	bind_slope_image(preview_slope_tex);
+	generator->setInt("grid_spacing", preview_spacing);
+	glm::ivec3 local_size = generator->getLocalSize();
+	glDispatchCompute((preview_size.x + local_size.x - 1) / local_size.x, (preview_size.y + local_size.y - 1) / local_size.y, 1);
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+	// Linear blits map texel centres, so the preview rectangle is shifted half a spacing down to put sample s about
+	// over texel s * preview_spacing; the part outside the heightmap is clipped away
+	GLint origin = -(GLint)preview_spacing / 2;
+	glm::ivec2 end = glm::ivec2(origin) + glm::ivec2(preview_size * preview_spacing);
+	GLuint framebuffers[2];
+	glCreateFramebuffers(2, framebuffers);
+	auto stretch = [&](GLuint source, GLuint target) {
+		glNamedFramebufferTexture(framebuffers[0], GL_COLOR_ATTACHMENT0, source, 0);
+		glNamedFramebufferTexture(framebuffers[1], GL_COLOR_ATTACHMENT0, target, 0);
+		glBlitNamedFramebuffer(framebuffers[0], framebuffers[1], 0, 0, preview_size.x, preview_size.y,
+			origin, origin, end.x, end.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	};
+	if (data_format == FULL || (refine_channels & HEIGHT_CHANNEL))
+		stretch(preview_tex, data_tex);
+	if (data_format == PACKED && (refine_channels & BIOME_CHANNEL))
+		stretch(preview_biome_tex, biome_tex);
+	if (refine_channels & HEIGHT_CHANNEL)
+		stretch(preview_slope_tex, slope_tex);
+	glDeleteFramebuffers(2, framebuffers);
+}
+
+bool Terrain::refine(const glm::vec3& eye, double budget_ms)
+{
+	// fold in the timers that are ready, oldest first
+	while (!refine_timers.empty()) {
+		RefineTimer& timer = refine_timers.front();
+		GLuint available = 0;
+		glGetQueryObjectuiv(timer.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(timer.query, GL_QUERY_RESULT, &elapsed);
+		// the call costs the frame its GPU time or its CPU time, whichever is longer; the bounds readbacks make the CPU
+		// wait for most of the GPU work anyway, and some software drivers report next to no GPU time
+		double tile_ms = std::max(elapsed / 1e6, timer.cpu_ms) / timer.tiles;
+		refine_tile_ms = refine_tile_ms > 0.0 ? refine_tile_ms * 0.75 + tile_ms * 0.25 : tile_ms;
+		free_refine_queries.push_back(timer.query);
+		refine_timers.erase(refine_timers.begin());
+	}
+	if (refine_tiles.empty())
+		return true;
+
+	unsigned int count = 1;
+	if (refine_tile_ms > 0.0)
+		count = (unsigned int)std::min((double)refine_tiles.size(), std::max(budget_ms / refine_tile_ms, 1.0));
+	GLuint query;
+	if (free_refine_queries.empty())
+		glGenQueries(1, &query);
+	else {
+		query = free_refine_queries.back();
+		free_refine_queries.pop_back();
+	}
+	auto start = std::chrono::steady_clock::now();
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	// same placement as the patch vertices: texel space shifted to center the terrain on the origin
+	glm::vec2 eye_texel = glm::vec2(eye.x, eye.z) + glm::vec2(width, height) / 2.0f;
+	for (unsigned int i = 0; i < count; i++) {
+		auto nearest = std::min_element(refine_tiles.begin(), refine_tiles.end(), [&eye_texel](glm::uvec2 a, glm::uvec2 b) {
+			glm::vec2 da = glm::vec2(a) + REFINE_TILE_SIZE / 2.0f - eye_texel;
+			glm::vec2 db = glm::vec2(b) + REFINE_TILE_SIZE / 2.0f - eye_texel;
+			return glm::dot(da, da) < glm::dot(db, db);
+		});
+		glm::uvec2 origin = *nearest;
+		*nearest = refine_tiles.back();
+		refine_tiles.pop_back();
+		refine_tile(origin);
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	refine_timers.push_back({ query, count, elapsed.count() });
+
+	if (refine_channels & HEIGHT_CHANNEL) {
+		culler_dirty = true;
+		upload_patch_ranges();
+	}
+	if (refine_tiles.empty()) {
+		std::cout << (data_cached ? "Loaded terrain from the cache in " : "Refined terrain in ") << refine_total << " tiles" << std::endl;
+		// every tile generated the heights again, none are shifted ones any more
+		if (refine_channels & HEIGHT_CHANNEL)
+			height_shifted = false;
+		store_cached();
+	}
+	return refine_tiles.empty();
+}
+
+void Terrain::refine_tile(glm::uvec2 origin)
+{
+	glm::uvec2 size = glm::min(glm::uvec2(REFINE_TILE_SIZE), glm::uvec2(width, height) - origin);
+	// an entry found damaged is removed, the tiles are generated from then on
+	if (data_cached)
+		data_cached = load_cached(origin, size);
+	if (!data_cached)
+		generate_region(origin, size, refine_channels);
+	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	if (refine_channels & HEIGHT_CHANNEL) {
+		reduce_bounds(height_pyramid.cells_touched(origin.x, origin.y, size.x, size.y));
+		update_roughness(origin, size);
+	}
+}
+
+void Terrain::update_roughness(glm::uvec2 origin, glm::uvec2 size)
+{
+	glm::uvec2 extent(width, height);
+	glm::uvec2 first = origin * resolution / extent;
+	glm::uvec2 last = (origin + size - 1u) * resolution / extent;
+	first = glm::max(first, 1u) - 1u;
+	last = glm::min(last + 1u, glm::uvec2(resolution - 1));
+	estimate_roughness(first, last - first + 1u);
 }
 
 void Terrain::draw() {
-	shader->use();
-	glBindVertexArray(VAO);	
-	glDrawArrays(GL_PATCHES, 0, resolution * resolution * 4);
+	if (triangle_query_pending) {
+		GLuint available = 0;
+		glGetQueryObjectuiv(triangle_query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			glGetQueryObjectui64v(triangle_query, GL_QUERY_RESULT, &triangles);
+			triangle_query_pending = false;
+		}
+	}
+	if (!triangle_query_pending)
+		glBeginQuery(GL_PRIMITIVES_GENERATED, triangle_query);
+	if (render_mode == CDLOD) {
+		cdlod_shader->use();
+		glBindVertexArray(cdlod_VAO);
+		GLsizei count = CDLOD_GRID_SIZE * CDLOD_GRID_SIZE * 6;
+		glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, nullptr, (GLsizei)lod_instances.size());
+	}
+	else {
+		shader->use();
+		glBindVertexArray(VAO);
+		draw_patches();
+	}
+	if (!triangle_query_pending) {
+		glEndQuery(GL_PRIMITIVES_GENERATED);
+		triangle_query_pending = true;
+	}
+	glBindVertexArray(0);
 	// LEGACY: no tessellation
 	//for (unsigned int strip = 0; strip < NUM_STRIPS; strip++)
 	//{
@@ -41,54 +476,529 @@ void Terrain::draw() {
 	//}
 }
 
+void Terrain::draw_patches()
+{
+	if (culls_on_cpu()) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+		if (patch_layout == SHARED_GRID)
+			glMultiDrawElementsIndirect(GL_PATCHES, index_type, nullptr, (GLsizei)element_commands.size(), 0);
+		else
+			glMultiDrawArraysIndirect(GL_PATCHES, nullptr, (GLsizei)draw_commands.size(), 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	else if (patch_layout == SHARED_GRID)
+		glDrawElements(GL_PATCHES, get_num_patches() * 4, index_type, nullptr);
+	else
+		glDrawArrays(GL_PATCHES, 0, get_num_patches() * 4);
+}
+
+void Terrain::cull(const glm::mat4& view_projection, const glm::vec3& eye)
+{
+	if (render_mode == TESSELLATION && !culls_on_cpu())
+		return;
+	auto start = std::chrono::steady_clock::now();
+	glm::vec2 height_transform(height_scale, height_shift);
+	if (culler_dirty || height_transform != culler_height_transform) {
+		patch_culler.set_bounds(resolution, get_num_node_levels(), [this](unsigned int level, unsigned int i, unsigned int j) {
+			return get_node_bounds(level, i, j);
+		});
+		culler_dirty = false;
+		culler_height_transform = height_transform;
+	}
+	Frustum frustum(view_projection);
+	if (render_mode == CDLOD) {
+		select_lod_nodes(frustum, eye);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		culling_ms = elapsed.count();
+		return;
+	}
+	if (culling == QUADTREE_CULLING)
+		patch_culler.cull_quadtree(frustum, visible_runs);
+	else
+		patch_culler.cull_flat(frustum, visible_runs);
+
+	// patch p = i * resolution + j is the order gen_patch_buffers() lays them out in, so a run of patches is a run of
+	// 4 vertices (or indices) per patch
+	draw_commands.clear();
+	element_commands.clear();
+	num_visible_patches = 0;
+	for (auto& run : visible_runs) {
+		if (patch_layout == SHARED_GRID)
+			element_commands.push_back({ run.count * 4, 1, run.first * 4, 0, 0 });
+		else
+			draw_commands.push_back({ run.count * 4, 1, run.first * 4, 0 });
+		num_visible_patches += run.count;
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	culling_ms = elapsed.count();
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+	if (patch_layout == SHARED_GRID)
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, element_commands.size() * sizeof(DrawElementsIndirectCommand), element_commands.data(), GL_STREAM_DRAW);
+	else
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, draw_commands.size() * sizeof(DrawArraysIndirectCommand), draw_commands.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void Terrain::select_lod_nodes(const Frustum& frustum, const glm::vec3& eye)
+{
+	// Where a node meets a finer one, the finer node is fully morphed and the coarse one must not have started morphing
+	// yet. The shared edge is at most the finer range plus the diagonal of the finer node's parent (heights included)
+	// away, and the coarse morph starts morph_start of the way into its range, which gives the shortest range that
+	// keeps the levels crack free
+	morph_start = glm::clamp(morph_start, 0.1f, 0.95f);
+	float patch_size = (float)std::max(width, height) / (float)resolution;
+	float min_distance = (2.0f * std::sqrt(2.0f) * patch_size + height_scale) / morph_start;
+
+	// shrink the ranges until the selection fits the budget, giving up after a few tries or at the shortest range
+	float range_scale = 1.0f;
+	for (int attempt = 0; ; attempt++) {
+		float distance = std::max(lod_distance * range_scale, min_distance);
+		lod_ranges.resize(patch_culler.get_num_levels());
+		for (size_t level = 0; level < lod_ranges.size(); level++)
+			lod_ranges[level] = distance * (float)(1u << level);
+		patch_culler.select_lod(frustum, eye, lod_ranges, lod_nodes);
+		if (triangle_budget == 0 || get_lod_triangles() <= triangle_budget || attempt == 8 || distance == min_distance)
+			break;
+		range_scale *= 0.8f;
+	}
+
+	lod_instances.clear();
+	for (auto& node : lod_nodes) {
+		float size = (float)(1u << node.level) / (float)resolution;
+		lod_instances.emplace_back(node.i * size, node.j * size, size, (float)node.level);
+	}
+	glNamedBufferData(cdlod_instance_buffer, lod_instances.size() * sizeof(glm::vec4), lod_instances.data(), GL_STREAM_DRAW);
+}
+
+void Terrain::set_cdlod_uniforms(Camera* camera, const glm::mat4& view_projection)
+{
+	cdlod_shader->use();
+	cdlod_shader->setMat4("model", view_projection);
+	cdlod_shader->setFloat("height_scale", height_scale);
+	cdlod_shader->setFloat("height_shift", height_shift);
+	cdlod_shader->setVec2("patch_scale", glm::vec2(width, height));
+	cdlod_shader->setVec2("patch_offset", -glm::vec2(width, height) / 2.0f);
+	cdlod_shader->setInt("grid_size", CDLOD_GRID_SIZE);
+	cdlod_shader->setVec3("eye", camera->position);
+	// level l morphs over the last (1 - morph_start) of the distances it covers, (ranges[l - 1], ranges[l]]; the root
+	// has no coarser level to morph into
+	// keep in sync with MAX_LOD_LEVELS in cdlod.vert
+	const unsigned int max_levels = 16;
+	glm::vec2 morph_ranges[max_levels];
+	for (unsigned int level = 0; level < max_levels; level++) {
+		if (level + 1 >= lod_ranges.size()) {
+			morph_ranges[level] = glm::vec2(1e30f, 2e30f);
+			continue;
+		}
+		float previous = level > 0 ? lod_ranges[level - 1] : 0.0f;
+		morph_ranges[level] = glm::vec2(previous + (lod_ranges[level] - previous) * morph_start, lod_ranges[level]);
+	}
+	glUniform2fv(glGetUniformLocation(cdlod_shader->ID, "morph_ranges"), max_levels, &morph_ranges[0][0]);
+	if (data_tex)
+	{
+		glBindTextureUnit(0, data_tex);
+		cdlod_shader->setInt("terrain_data", 0);
+		glBindTextureUnit(1, data_format == PACKED ? biome_tex : data_tex);
+		cdlod_shader->setInt("biome_data", 1);
+		cdlod_shader->setBool("packed_data", data_format == PACKED);
+		glBindTextureUnit(2, slope_tex);
+		cdlod_shader->setInt("slope_data", 2);
+		cdlod_shader->setBool("lighting", lighting);
+	}
+	else
+		std::cout << "Failed to load data." << std::endl;
+}
+
 void Terrain::set_uniforms(Camera* camera, glm::mat4 view_projection)
 {
+	if (render_mode == CDLOD) {
+		set_cdlod_uniforms(camera, view_projection);
+		return;
+	}
+	// the pre-pass switches programs, so it runs before the draw shader gets its uniforms
+	compute_tess_factors(camera->get_view_matrix(), view_projection);
 	shader->use();
 	shader->setMat4("model", view_projection);
 	shader->setMat4("view", camera->get_view_matrix());
 	shader->setFloat("height_scale", height_scale);
 	shader->setFloat("height_shift", height_shift);
-	shader->setInt("min_tess_level", min_tess_level);
-	shader->setInt("max_tess_level", max_tess_level);
-	shader->setFloat("min_distance", min_distance);
-	shader->setFloat("max_distance", max_distance);
+	shader->setInt("resolution", resolution);
+	// texel space shifted to center the terrain on the origin
+	shader->setVec2("patch_scale", glm::vec2(width, height));
+	shader->setVec2("patch_offset", -glm::vec2(width, height) / 2.0f);
+	shader->setBool("procedural_patches", patch_layout == PROCEDURAL);
+	shader->setBool("quantized_vertices", vertex_format == QUANTIZED_VERTICES);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, tess_factor_buffer);
 	if (data_tex)
 	{
 		glActiveTexture(GL_TEXTURE0);
 		glBindTextureUnit(0, data_tex);
 		shader->setInt("terrain_data", 0);
+		// the sampler has to point at a valid texture even when it isn't read
+		glBindTextureUnit(1, data_format == PACKED ? biome_tex : data_tex);
+		shader->setInt("biome_data", 1);
+		shader->setBool("packed_data", data_format == PACKED);
+		glBindTextureUnit(2, slope_tex);
+		shader->setInt("slope_data", 2);
+		shader->setBool("lighting", lighting);
 	}
 	else
 		std::cout << "Failed to load data." << std::endl;
 }
 
-void Terrain::gen_data() 
+size_t Terrain::get_data_size() const
 {
-	glCreateTextures(GL_TEXTURE_2D, 1, &data_tex);
-	glTextureParameteri(data_tex, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTextureParameteri(data_tex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTextureParameteri(data_tex, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTextureParameteri(data_tex, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTextureStorage2D(data_tex, 1, GL_RGBA32F, width, height);
-	glBindImageTexture(0, data_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	// the channels and the RG16F slope
+	return (size_t)width * height * ((data_format == PACKED ? 4 : 16) + 4);
+}
 
+std::string Terrain::generator_prelude(DataFormat format)
+{
+	return format == PACKED ? "#define PACKED_STORAGE\n" : "";
+}
 
-	// set noise params
-	generator->use();
-	generator->setVec3("offset", noise_settings.offset);
-	generator->setFloat("frequency", noise_settings.frequency);
-	generator->setInt("octaves", noise_settings.octaves);
-	generator->setFloat("amplitude", noise_settings.amplitude);
-	generator->setFloat("lacunarity", noise_settings.lacunarity);
-	generator->setFloat("gain", noise_settings.gain);
-	generator->setFloat("range", noise_settings.range);
-	// dispatch shader
-	glDispatchCompute((GLuint)width, (GLuint)height, 1);
+void Terrain::create_data_textures(unsigned int width, unsigned int height, DataFormat format, GLuint& data_tex, GLuint& biome_tex)
+{
+	if (format == PACKED) {
+		data_tex = create_data_texture(width, height, GL_R16);
+		biome_tex = create_data_texture(width, height, GL_RG8);
+	}
+	else {
+		data_tex = create_data_texture(width, height, GL_RGBA32F);
+		biome_tex = 0;
+	}
+}
+
+void Terrain::bind_data_images(DataFormat format, GLuint data_tex, GLuint biome_tex)
+{
+	if (format == PACKED) {
+		glBindImageTexture(0, data_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R16);
+		glBindImageTexture(1, biome_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG8);
+	}
+	else
+		// read too when only some of the channels of a texel are written
+		glBindImageTexture(0, data_tex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+}
+
+void Terrain::gen_data(const Terrain* previous) 
+{
+	create_data_textures(width, height, data_format, data_tex, biome_tex);
+	slope_tex = create_data_texture(width, height, GL_RG16F);
+	auto start = std::chrono::steady_clock::now();
+	if (load_cached(glm::uvec2(0), glm::uvec2(width, height))) {
+		glFinish();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "Loaded terrain data from the cache in " << elapsed.count() << " ms, " << get_data_size() / (1024 * 1024) << " MiB" << std::endl;
+		return;
+	}
+	reuse_data(previous);
+
+	// one invocation per texel not reused, timed so generator variants can be compared
+	GLuint timer;
+	glGenQueries(1, &timer);
+	glBeginQuery(GL_TIME_ELAPSED, timer);
+	generate_rows(0, height);
+	glEndQuery(GL_TIME_ELAPSED);
 	// ensure shader is done writing
 	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &elapsed);
+	glDeleteQueries(1, &timer);
+	std::cout << "Generated terrain data in " << elapsed / 1e6 << " ms on the GPU, " << get_data_size() / (1024 * 1024) << " MiB" << std::endl;
+	store_cached();
+}
+
+bool Terrain::load_cached(glm::uvec2 origin, glm::uvec2 size)
+{
+	if (cache == nullptr)
+		return false;
+	TerrainCache::Textures textures = { data_format, data_tex, biome_tex, slope_tex };
+	return cache->load(cache->make_key(noise_settings, width, height, data_format), textures, width, height, origin, size);
+}
+
+void Terrain::store_cached()
+{
+	// shifted heights can differ from generated ones by the rounding of the noise position, they stay out of the cache
+	if (cache == nullptr || height_shifted)
+		return;
+	uint64_t key = cache->make_key(noise_settings, width, height, data_format);
+	if (cache->contains(key))
+		return;
+	TerrainCache::Textures textures = { data_format, data_tex, biome_tex, slope_tex };
+	cache->store(key, textures, width, height);
+}
+
+void Terrain::reuse_data(const Terrain* previous)
+{
+	if (previous == nullptr || previous->data_format != data_format || previous->noise_settings != noise_settings
+		|| !previous->is_built() || !previous->is_refined())
+		return;
+	reused = glm::min(glm::uvec2(width, height), glm::uvec2(previous->width, previous->height));
+	glCopyImageSubData(previous->data_tex, GL_TEXTURE_2D, 0, 0, 0, 0, data_tex, GL_TEXTURE_2D, 0, 0, 0, 0, reused.x, reused.y, 1);
+	if (data_format == PACKED)
+		glCopyImageSubData(previous->biome_tex, GL_TEXTURE_2D, 0, 0, 0, 0, biome_tex, GL_TEXTURE_2D, 0, 0, 0, 0, reused.x, reused.y, 1);
+	glCopyImageSubData(previous->slope_tex, GL_TEXTURE_2D, 0, 0, 0, 0, slope_tex, GL_TEXTURE_2D, 0, 0, 0, 0, reused.x, reused.y, 1);
+	std::cout << "Reused " << reused.x << "x" << reused.y << " texels of the previous terrain" << std::endl;
+}
+
+void Terrain::generate_rows(unsigned int first, unsigned int count)
+{
+	// the rows of the reused block only miss the columns right of it
+	unsigned int end = first + count;
+	unsigned int split = glm::clamp(reused.y, first, end);
+	if (split > first && reused.x < width)
+		generate_region(glm::uvec2(reused.x, first), glm::uvec2(width - reused.x, split - first));
+	if (end > split)
+		generate_region(glm::uvec2(0, split), glm::uvec2(width, end - split));
+}
+
+void Terrain::generate_region(glm::uvec2 origin, glm::uvec2 size, unsigned int channels)
+{
+	bind_data_images(data_format, data_tex, biome_tex);
+	set_generator_uniforms(generator, noise_settings);
+	bind_slope_image(slope_tex);
+	generator->setIVec2("grid_origin", glm::ivec2(origin));
+	generator->setIVec2("grid_count", glm::ivec2(size));
+	generator->setInt("channels", channels);
+	glm::ivec3 local_size = generator->getLocalSize();
+	glDispatchCompute((size.x + local_size.x - 1) / local_size.x, (size.y + local_size.y - 1) / local_size.y, 1);
+}
+
+void Terrain::bind_slope_image(GLuint tex)
+{
+	glBindImageTexture(2, tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+	generator->setBool("write_slope", true);
+}
+
+void Terrain::create_bounds_textures()
+{
+	height_pyramid.resize(width, height);
+	bounds_textures.resize(height_pyramid.get_num_levels());
+	glCreateTextures(GL_TEXTURE_2D, (GLsizei)bounds_textures.size(), bounds_textures.data());
+	for (unsigned int level = 0; level < bounds_textures.size(); level++) {
+		glm::uvec2 size = height_pyramid.get_level_size(level);
+		glTextureStorage2D(bounds_textures[level], 1, GL_RG32F, size.x, size.y);
+	}
+}
+
+void Terrain::gen_bounds()
+{
+	create_bounds_textures();
+	glm::uvec2 cells = height_pyramid.get_level_size(0);
+	reduce_bounds(glm::uvec4(0, 0, cells.x - 1, cells.y - 1));
+	glm::vec2 range = height_pyramid.get_cell(height_pyramid.get_num_levels() - 1, 0, 0);
+	std::cout << "Built height bounds: " << bounds_textures.size() << " levels, heights in [" << range.x << ", " << range.y << "]" << std::endl;
+}
+
+void Terrain::gen_roughness()
+{
+	create_roughness_buffer();
+	estimate_roughness(glm::uvec2(0), glm::uvec2(resolution));
+}
+
+void Terrain::create_roughness_buffer()
+{
+	glGenBuffers(1, &roughness_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, roughness_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)get_num_patches() * ROUGHNESS_STRIDE * sizeof(float), nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Terrain::estimate_roughness(glm::uvec2 first, glm::uvec2 count, int samples)
+{
+	roughness_estimator->use();
+	glBindTextureUnit(0, data_tex);
+	roughness_estimator->setInt("terrain_data", 0);
+	roughness_estimator->setInt("resolution", resolution);
+	// one sample per texel of the patch, capped where the error estimate stops improving noticeably
+	if (samples <= 0)
+		samples = glm::clamp((int)(std::max(width, height) / resolution), 1, 64);
+	roughness_estimator->setInt("samples", samples);
+	roughness_estimator->setIVec2("first_patch", glm::ivec2(first));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, roughness_buffer);
+	glDispatchCompute(count.x, count.y, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void Terrain::gen_tess_buffers()
+{
+	size_t edges = (size_t)(resolution + 1) * resolution;
+	glGenBuffers(1, &tess_factor_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, tess_factor_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (2 * edges + get_num_patches()) * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+	glGenBuffers(1, &patch_range_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, patch_range_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, get_num_patches() * sizeof(glm::vec2), nullptr, GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	upload_patch_ranges();
+}
+
+void Terrain::upload_patch_ranges()
+{
+	std::vector<glm::vec2> ranges;
+	ranges.reserve(get_num_patches());
+	for (unsigned int i = 0; i < resolution; i++)
+		for (unsigned int j = 0; j < resolution; j++)
+			ranges.push_back(height_pyramid.get_range(width * i / (float)resolution, height * j / (float)resolution,
+				width * (i + 1) / (float)resolution, height * (j + 1) / (float)resolution));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, patch_range_buffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, ranges.size() * sizeof(glm::vec2), ranges.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Terrain::compute_tess_factors(const glm::mat4& view, const glm::mat4& view_projection)
+{
+	tess_estimator->use();
+	tess_estimator->setMat4("view", view);
+	tess_estimator->setInt("resolution", resolution);
+	tess_estimator->setVec2("terrain_size", glm::vec2(width, height));
+	tess_estimator->setFloat("height_scale", height_scale);
+	tess_estimator->setFloat("height_shift", height_shift);
+	tess_estimator->setInt("min_tess_level", min_tess_level);
+	tess_estimator->setInt("max_tess_level", max_tess_level);
+	tess_estimator->setFloat("min_distance", min_distance);
+	tess_estimator->setFloat("max_distance", max_distance);
+	tess_estimator->setBool("screen_space_error", screen_space_error);
+	tess_estimator->setFloat("pixel_error", pixel_error);
+	// projection[1][1] = 1 / tan(fov_y / 2), recovered from the view-projection the camera was combined into
+	glm::mat4 projection = view_projection * glm::inverse(view);
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	tess_estimator->setFloat("projection_scale", viewport[3] * 0.5f * projection[1][1]);
+	tess_estimator->setBool("cull", culling == PREPASS_CULLING);
+	Frustum frustum(view_projection);
+	glUniform4fv(glGetUniformLocation(tess_estimator->ID, "frustum_planes"), Frustum::NUM_PLANES, &frustum.planes[0][0]);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, roughness_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, tess_factor_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, patch_range_buffer);
+	GLuint invocations = 2 * (resolution + 1) * resolution + get_num_patches();
+	glDispatchCompute((invocations + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void Terrain::reduce_bounds(glm::uvec4 cells)
+{
+	bounds_reducer->use();
+	bounds_reducer->setInt("cell_size", HeightPyramid::CELL_SIZE);
+	glBindTextureUnit(0, data_tex);
+	bounds_reducer->setInt("height_data", 0);
+
+	glm::uvec4 level_cells = cells;
+	for (unsigned int level = 0; level < bounds_textures.size(); level++) {
+		glm::uvec2 count(level_cells.z - level_cells.x + 1, level_cells.w - level_cells.y + 1);
+		bounds_reducer->setInt("level", level);
+		bounds_reducer->setIVec2("cell_offset", glm::ivec2(level_cells.x, level_cells.y));
+		bounds_reducer->setIVec2("cell_count", glm::ivec2(count));
+		// level 0 reads the heightmap, range_in just has to be a valid binding
+		glBindImageTexture(0, bounds_textures[level > 0 ? level - 1 : 0], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+		glBindImageTexture(1, bounds_textures[level], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+		glDispatchCompute((count.x + 7) / 8, (count.y + 7) / 8, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		level_cells /= 2u;
+	}
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	// read the updated rectangles straight into the rows of the CPU levels
+	level_cells = cells;
+	for (unsigned int level = 0; level < bounds_textures.size(); level++) {
+		glm::uvec2 size = height_pyramid.get_level_size(level);
+		glm::uvec2 count(level_cells.z - level_cells.x + 1, level_cells.w - level_cells.y + 1);
+		size_t first = (size_t)level_cells.y * size.x + level_cells.x;
+		glPixelStorei(GL_PACK_ROW_LENGTH, size.x);
+		glGetTextureSubImage(bounds_textures[level], 0, level_cells.x, level_cells.y, 0, count.x, count.y, 1, GL_RG, GL_FLOAT,
+			(GLsizei)(((size_t)size.x * size.y - first) * sizeof(glm::vec2)), height_pyramid.get_level_data(level) + first);
+		level_cells /= 2u;
+	}
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+}
+
+void Terrain::update_bounds(unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+	if (w > 0 && h > 0) {
+		reduce_bounds(height_pyramid.cells_touched(x, y, w, h));
+		culler_dirty = true;
+		upload_patch_ranges();
+	}
 }
 
-void Terrain::gen_vertices() 
+AABB Terrain::get_bounds(float x0, float y0, float x1, float y1) const
+{
+	glm::vec2 range = height_pyramid.get_range(x0, y0, x1, y1);
+	// same placement as the patch vertices: texel space shifted to center the terrain on the origin
+	return AABB(glm::vec3(x0 - width / 2.0f, range.x * height_scale - height_shift, y0 - height / 2.0f),
+		glm::vec3(x1 - width / 2.0f, range.y * height_scale - height_shift, y1 - height / 2.0f));
+}
+
+AABB Terrain::get_patch_bounds(unsigned int i, unsigned int j) const
+{
+	return get_node_bounds(0, i, j);
+}
+
+AABB Terrain::get_node_bounds(unsigned int level, unsigned int i, unsigned int j) const
+{
+	unsigned int first_i = i << level, first_j = j << level;
+	unsigned int end_i = std::min(resolution, (i + 1) << level), end_j = std::min(resolution, (j + 1) << level);
+	return get_bounds(width * first_i / (float)resolution, height * first_j / (float)resolution,
+		width * end_i / (float)resolution, height * end_j / (float)resolution);
+}
+
+unsigned int Terrain::get_num_node_levels() const
+{
+	unsigned int levels = 1;
+	while ((1u << (levels - 1)) < resolution)
+		levels++;
+	return levels;
+}
+
+void Terrain::set_generator_uniforms(ComputeShader* generator, const NoiseSettings& settings)
+{
+	generator->use();
+	generator->setVec3("offset", settings.offset);
+	generator->setFloat("frequency", settings.frequency);
+	generator->setInt("octaves", settings.octaves);
+	generator->setFloat("amplitude", settings.amplitude);
+	generator->setFloat("lacunarity", settings.lacunarity);
+	generator->setFloat("gain", settings.gain);
+	generator->setFloat("range", settings.range);
+	generator->setFloat("biome_frequency", settings.biome_frequency);
+	generator->setInt("biome_octaves", settings.biome_octaves);
+	generator->setFloat("biome_amplitude", settings.biome_amplitude);
+	generator->setFloat("biome_lacunarity", settings.biome_lacunarity);
+	generator->setFloat("biome_gain", settings.biome_gain);
+	generator->setFloat("biome_range", settings.biome_range);
+	generator->setBool("band_limit", settings.band_limit);
+	generator->setInt("channels", ALL_CHANNELS);
+	// only Terrain keeps slopes, see bind_slope_image()
+	generator->setBool("write_slope", false);
+	// the whole image, one sample per texel; Clipmap changes these on the same program
+	generator->setIVec2("grid_origin", glm::ivec2(0));
+	generator->setIVec2("grid_count", glm::ivec2(-1));
+	generator->setInt("grid_spacing", 1);
+}
+
+void Terrain::set_patch_layout(PatchLayout layout)
+{
+	if (layout == patch_layout)
+		return;
+	patch_layout = layout;
+	// a deferred build creates them when it gets there
+	if (is_built())
+		gen_patch_buffers();
+}
+
+void Terrain::set_vertex_format(VertexFormat format)
+{
+	if (format == vertex_format)
+		return;
+	vertex_format = format;
+	if (is_built())
+		gen_patch_buffers();
+}
+
+void Terrain::gen_patch_buffers()
 {
 	// LEGACY: no tessellation
 	//for (unsigned int i = 0; i < height; i++)
@@ -99,51 +1009,110 @@ void Terrain::gen_vertices()
 	//		//uvs.push_back(x / vert_dim);
 	//		//uvs.push_back(z / vert_dim);
 	//	}
-	
-	// Create a grid of RxR patches (R = resolution), each with 4 control points
-	for (unsigned int i = 0; i < resolution; i++) {
-		for (unsigned int j = 0; j < resolution; j++) {
-			// 1st CONTROL POINT
-			// vertex coords
-			vertices.emplace_back(width * i / (float)resolution - (float)width / 2.0f);
-			vertices.emplace_back(0.0f);
-			vertices.emplace_back(height * j / (float)resolution - (float)height / 2.0f);
-
-			// uv coords
-			vertices.emplace_back(i / (float)resolution);
-			vertices.emplace_back(j / (float)resolution);
-
-			// 2nd CONTROL POINT
-			// vertex coords
-			vertices.emplace_back(width * (i + 1) / (float)resolution - (float)width / 2.0f);
-			vertices.emplace_back(0.0f);
-			vertices.emplace_back(height * j / (float)resolution - (float)height / 2.0f);
-
-			// uv coords
-			vertices.emplace_back((i + 1) / (float)resolution);
-			vertices.emplace_back(j / (float)resolution);
-
-			// 3rd CONTROL POINT
-			// vertex coords
-			vertices.emplace_back(width * i / (float)resolution - (float)width / 2.0f);
-			vertices.emplace_back(0.0f);
-			vertices.emplace_back(height * (j + 1) / (float)resolution - (float)height / 2.0f);
-
-			// uv coords
-			vertices.emplace_back(i / (float)resolution);
-			vertices.emplace_back((j + 1) / (float)resolution);
-
-			// 4th CONTROL POINT
-			// vertex coords
-			vertices.emplace_back(width * (i + 1) / (float)resolution - (float)width / 2.0f);
-			vertices.emplace_back(0.0f);
-			vertices.emplace_back(height * (j + 1) / (float)resolution - (float)height / 2.0f);
-
-			// uv coords
-			vertices.emplace_back((i + 1) / (float)resolution);
-			vertices.emplace_back((j + 1) / (float)resolution);
+
+	glBindVertexArray(VAO);
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+	VBO = EBO = 0;
+	patch_buffer_size = 0;
+	int pos_location = glGetAttribLocation(shader->ID, "v_pos");
+	int tex_location = glGetAttribLocation(shader->ID, "v_tex");
+	int grid_location = glGetAttribLocation(shader->ID, "v_grid");
+	// the disabled attributes read their constant default, shader.vert ignores them
+	for (int location : { pos_location, tex_location, grid_location })
+		if (location >= 0)
+			glDisableVertexAttribArray(location);
+
+	if (patch_layout == PROCEDURAL) {
+		glBindVertexArray(0);
+		std::cout << "Procedural patches: no vertex data." << std::endl;
+		return;
+	}
+
+	bool quantized = vertex_format == QUANTIZED_VERTICES && resolution < 65536;
+	if (!quantized)
+		vertex_format = FLOAT_VERTICES;
+	size_t vertex_size = quantized ? 2 * sizeof(GLushort) : 5 * sizeof(GLfloat);
+	// one vertex_size record per vertex, kept as bytes so both formats share the layout code below
+	std::vector<unsigned char> vertices;
+	// grid corner (i, j): either the corner itself or position (x, 0, z) and uv
+	auto add_corner = [&](unsigned int i, unsigned int j) {
+		size_t offset = vertices.size();
+		vertices.resize(offset + vertex_size);
+		if (quantized) {
+			GLushort corner[2] = { (GLushort)i, (GLushort)j };
+			memcpy(&vertices[offset], corner, sizeof(corner));
+		}
+		else {
+			GLfloat vertex[5] = {
+				width * i / (float)resolution - (float)width / 2.0f, 0.0f, height * j / (float)resolution - (float)height / 2.0f,
+				i / (float)resolution, j / (float)resolution
+			};
+			memcpy(&vertices[offset], vertex, sizeof(vertex));
 		}
+	};
+	if (patch_layout == SEPARATE_PATCHES) {
+		// Create a grid of RxR patches (R = resolution), each with 4 control points
+		vertices.reserve((size_t)get_num_patches() * 4 * vertex_size);
+		for (unsigned int i = 0; i < resolution; i++)
+			for (unsigned int j = 0; j < resolution; j++) {
+				add_corner(i, j);
+				add_corner(i + 1, j);
+				add_corner(i, j + 1);
+				add_corner(i + 1, j + 1);
+			}
 	}
+	else {
+		// (R + 1)^2 corners, corner (i, j) at i * (R + 1) + j, and the 4 corner indices of every patch
+		unsigned int side = resolution + 1;
+		vertices.reserve((size_t)side * side * vertex_size);
+		for (unsigned int i = 0; i < side; i++)
+			for (unsigned int j = 0; j < side; j++)
+				add_corner(i, j);
+
+		std::vector<GLuint> indices;
+		indices.reserve((size_t)get_num_patches() * 4);
+		for (unsigned int i = 0; i < resolution; i++)
+			for (unsigned int j = 0; j < resolution; j++) {
+				GLuint corner = i * side + j;
+				indices.insert(indices.end(), { corner, corner + side, corner + 1, corner + side + 1 });
+			}
+
+		glGenBuffers(1, &EBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		if ((size_t)side * side <= 65536) {
+			std::vector<GLushort> short_indices(indices.begin(), indices.end());
+			index_type = GL_UNSIGNED_SHORT;
+			patch_buffer_size += short_indices.size() * sizeof(GLushort);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, short_indices.size() * sizeof(GLushort), short_indices.data(), GL_STATIC_DRAW);
+		}
+		else {
+			index_type = GL_UNSIGNED_INT;
+			patch_buffer_size += indices.size() * sizeof(GLuint);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		}
+	}
+
+	glGenBuffers(1, &VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	patch_buffer_size += vertices.size();
+
+	if (quantized) {
+		// not normalized: the shader gets the integer corner as float and divides by the resolution itself
+		glVertexAttribPointer(grid_location, 2, GL_UNSIGNED_SHORT, GL_FALSE, (GLsizei)vertex_size, (void*)0);
+		glEnableVertexAttribArray(grid_location);
+	}
+	else {
+		glVertexAttribPointer(pos_location, 3, GL_FLOAT, GL_FALSE, (GLsizei)vertex_size, (void*)0);
+		glEnableVertexAttribArray(pos_location);
+		glVertexAttribPointer(tex_location, 2, GL_FLOAT, GL_FALSE, (GLsizei)vertex_size, (void*)(sizeof(float) * 3));
+		glEnableVertexAttribArray(tex_location);
+	}
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	std::cout << "Loaded vertices: " << vertices.size() / vertex_size << " for a total of " << patch_buffer_size << " bytes." << std::endl;
 }
 
 
@@ -164,26 +1133,56 @@ void Terrain::gen_buffers() {
 	glGenVertexArrays(1, &VAO);
 	glBindVertexArray(VAO);
 
-	// generate and bind VBO and fill it with vertex data
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
 
-	// generate and bind EBO and fill it with index data
-	//glGenBuffers(1, &EBO);
-	//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	//glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+	glGenBuffers(1, &indirect_buffer);
+	glGenQueries(1, &triangle_query);
 
-	int pos_location = glGetAttribLocation(shader->ID, "v_pos");
-	glVertexAttribPointer(pos_location, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)0);
-	glEnableVertexAttribArray(pos_location);
+	glBindVertexArray(0);
 
-	int tex_location = glGetAttribLocation(shader->ID, "v_tex");
-	glVertexAttribPointer(tex_location, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(sizeof(float) * 3));
-	glEnableVertexAttribArray(tex_location);
+	// vertex (and index) buffers of the patch grid
+	gen_patch_buffers();
+	gen_cdlod_mesh();
+}
 
-	glPatchParameteri(GL_PATCH_VERTICES, 4);
+void Terrain::gen_cdlod_mesh()
+{
+	glGenVertexArrays(1, &cdlod_VAO);
+	glBindVertexArray(cdlod_VAO);
 
-	glBindVertexArray(0);
+	// (N + 1)^2 corners, corner (i, j) at i * (N + 1) + j, two triangles per quad
+	const unsigned int side = CDLOD_GRID_SIZE + 1;
+	std::vector<GLushort> corners;
+	corners.reserve((size_t)side * side * 2);
+	for (unsigned int i = 0; i < side; i++)
+		for (unsigned int j = 0; j < side; j++)
+			corners.insert(corners.end(), { (GLushort)i, (GLushort)j });
+	std::vector<GLushort> indices;
+	indices.reserve((size_t)CDLOD_GRID_SIZE * CDLOD_GRID_SIZE * 6);
+	for (unsigned int i = 0; i < CDLOD_GRID_SIZE; i++)
+		for (unsigned int j = 0; j < CDLOD_GRID_SIZE; j++) {
+			GLushort corner = (GLushort)(i * side + j);
+			indices.insert(indices.end(), { corner, (GLushort)(corner + side), (GLushort)(corner + 1), (GLushort)(corner + 1), (GLushort)(corner + side), (GLushort)(corner + side + 1) });
+		}
+
+	glGenBuffers(1, &cdlod_VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, cdlod_VBO);
+	glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(GLushort), corners.data(), GL_STATIC_DRAW);
+	int grid_location = glGetAttribLocation(cdlod_shader->ID, "v_grid");
+	glVertexAttribPointer(grid_location, 2, GL_UNSIGNED_SHORT, GL_FALSE, 2 * sizeof(GLushort), (void*)0);
+	glEnableVertexAttribArray(grid_location);
+
+	glGenBuffers(1, &cdlod_EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cdlod_EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
 
+	glGenBuffers(1, &cdlod_instance_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, cdlod_instance_buffer);
+	int node_location = glGetAttribLocation(cdlod_shader->ID, "v_node");
+	glVertexAttribPointer(node_location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+	glVertexAttribDivisor(node_location, 1);
+	glEnableVertexAttribArray(node_location);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
@@ -6,45 +6,226 @@
 #include "compute_shader.h"
 #include "scene_object.h"
 #include "camera.h"
+#include "noise_settings.h"
+#include "height_pyramid.h"
+#include "patch_culler.h"
+#include "../utils/aabb.h"
 
-struct NoiseSettings {
-	glm::vec3 offset;
-	float frequency;
-	int octaves;
-	float amplitude;
-	float lacunarity;
-	float gain;
-	float range;
-
-	NoiseSettings(glm::vec3 offset, float frequency, int octaves, float amplitude, float lacunarity, float gain, float range) 
-		: offset(offset), frequency(frequency), octaves(octaves), amplitude(amplitude), lacunarity(lacunarity), gain(gain), range(range) {};
-};
-
+class TerrainCache;
 
 class Terrain : public SceneObject {
+public:
+	// GPU storage of the generated channels
+	enum DataFormat {
+		FULL,	// one RGBA32F texture: height, moisture, detail, 1.0 (16 bytes per texel)
+		PACKED	// R16 UNORM height + RG8 moisture/detail (4 bytes per texel), needs a generator built with generator_prelude(PACKED)
+	};
+	// generated channels, as a mask (the generator's channels uniform)
+	enum Channel {
+		HEIGHT_CHANNEL = 1,
+		BIOME_CHANNEL = 2,	// moisture and detail
+		ALL_CHANNELS = 3
+	};
+	// largest height error R16 UNORM storage introduces, as a fraction of height_scale (half a quantisation step,
+	// doubled in case the driver truncates instead of rounding when converting to UNORM)
+	static constexpr float PACKED_HEIGHT_ERROR = 1.0f / 65535.0f;
+	// floats per patch in the roughness buffer (shaders/terrain_roughness.comp): the height error of a uniform 2^k
+	// tessellation for k = 0..6, plus padding
+	static const unsigned int ROUGHNESS_STRIDE = 8;
+	// how the patch control points reach the vertex shader, patch (i, j) having corners (i, j), (i + 1, j), (i, j + 1)
+	// and (i + 1, j + 1) of the (resolution + 1)^2 grid in every layout
+	enum PatchLayout {
+		SEPARATE_PATCHES,	// 4 vertices of their own per patch, inner corners stored 4 times
+		SHARED_GRID,		// one vertex per grid corner plus 4 indices per patch (16 bit while the grid fits)
+		PROCEDURAL			// no vertex buffer, shader.vert derives every corner from gl_VertexID
+	};
+	// what a patch vertex stores, both place it at uv = corner / resolution and xz = uv * patch_scale + patch_offset
+	enum VertexFormat {
+		FLOAT_VERTICES,		// vec3 position (y always 0) + vec2 uv, 20 bytes
+		QUANTIZED_VERTICES	// the integer corner (i, j) as 2 x 16 bit, 4 bytes; needs resolution < 65536
+	};
+	// steps of a deferred build (see build()), in order
+	enum BuildStage {
+		BUILD_DATA,			// the heightmap, a band of rows per slice
+		BUILD_BOUNDS,		// the min/max pyramid, a row of level 0 cells per slice
+		BUILD_ROUGHNESS,	// the patch roughness, a run of patches within a row per slice
+		BUILD_BUFFERS,		// pre-pass and mesh buffers, in one slice
+		BUILD_DONE
+	};
+
 private:
 	const unsigned short int NUM_CHANNELS = 4;
 	// buffer objects
 	GLuint VAO = 0;
 	GLuint VBO = 0;
+	GLuint EBO = 0;
+	// one indirect command per run of consecutive visible patches, DrawElementsIndirectCommand with SHARED_GRID and
+	// DrawArraysIndirectCommand otherwise
+	GLuint indirect_buffer = 0;
+	PatchLayout patch_layout = SHARED_GRID;
+	VertexFormat vertex_format = QUANTIZED_VERTICES;
+	GLenum index_type = GL_UNSIGNED_INT;
+	size_t patch_buffer_size = 0;
+	// CDLOD: the shared grid mesh and one (uv origin, uv size, level) instance per selected node
+	GLuint cdlod_VAO = 0;
+	GLuint cdlod_VBO = 0;
+	GLuint cdlod_EBO = 0;
+	GLuint cdlod_instance_buffer = 0;
 
 	// shader programs
 	Shader* shader = nullptr;
+	Shader* cdlod_shader = nullptr;
 	ComputeShader* generator = nullptr;
+	ComputeShader* bounds_reducer = nullptr;
+	ComputeShader* roughness_estimator = nullptr;
+	ComputeShader* tess_estimator = nullptr;
 
 	// terrain data
 	unsigned int width, height, resolution;
 
-	// terrain texture
-	GLuint data_tex;
+	// terrain textures, biome_tex only exists with PACKED storage
+	DataFormat data_format;
+	GLuint data_tex = 0;
+	GLuint biome_tex = 0;
+	// slope of the height (dh/dx, dh/dy per texel, RG16F), generated with it for the normals
+	GLuint slope_tex = 0;
 
 	NoiseSettings noise_settings;
+	// on-disk cache the data is loaded from instead of generated when it holds these settings, and stored to once
+	// it was generated in full; data_cached tells a deferred build to load its rows and refine() its tiles (cleared
+	// when the entry turns out damaged), height_shifted that the heights were moved by shift_height() rather than
+	// generated and aren't stored until a full regeneration replaces them
+	TerrainCache* cache = nullptr;
+	bool data_cached = false;
+	bool height_shifted = false;
+
+	// min/max height pyramid, one RG32F texture per level (their sizes halve rounding up, unlike a mip chain) and
+	// the CPU copy the bounds queries read
+	std::vector<GLuint> bounds_textures;
+	HeightPyramid height_pyramid;
+
+	// per patch roughness for the screen-space error metric, ROUGHNESS_STRIDE floats per patch
+	GLuint roughness_buffer = 0;
+	// per frame edge levels and patch visibility of the tessellation pre-pass (shaders/terrain_tess.comp), and the
+	// per patch height ranges it culls with
+	GLuint tess_factor_buffer = 0;
+	GLuint patch_range_buffer = 0;
+	// GL_PRIMITIVES_GENERATED of the draws, read back a frame late so it never stalls
+	GLuint triangle_query = 0;
+	bool triangle_query_pending = false;
+	GLuint64 triangles = 0;
+
+	// frustum culling state: the patch bounds in the culler are rebuilt when the bounds or the height scale/shift change
+	struct DrawArraysIndirectCommand {
+		GLuint count;
+		GLuint instance_count;
+		GLuint first;
+		GLuint base_instance;
+	};
+	struct DrawElementsIndirectCommand {
+		GLuint count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+	PatchCuller patch_culler;
+	bool culler_dirty = true;
+	glm::vec2 culler_height_transform = glm::vec2(0.0f);
+	std::vector<PatchCuller::Run> visible_runs;
+	std::vector<DrawArraysIndirectCommand> draw_commands;
+	std::vector<DrawElementsIndirectCommand> element_commands;
+	unsigned int num_visible_patches = 0;
+	double culling_ms = 0.0;
+	// CDLOD selection of the last cull(): level ranges after fitting the triangle budget and the selected nodes
+	std::vector<float> lod_ranges;
+	std::vector<PatchCuller::LodNode> lod_nodes;
+	std::vector<glm::vec4> lod_instances;
+
+	// deferred build state: the current stage, the units of it done, and the measured cost of a unit of every stage
+	BuildStage build_stage = BUILD_DONE;
+	unsigned int build_progress = 0;
+	double build_unit_ms[BUILD_DONE] = {};
+	unsigned int build_frames = 0;
+	double build_ms = 0.0;
+	// block at the origin copied from the previous terrain, the build skips it
+	glm::uvec2 reused = glm::uvec2(0);
 
-	std::vector<GLfloat> vertices;
+	// progressive regeneration state: the preview and its sample spacing in texels, the tiles (texel origins) still
+	// showing it, and the timer queries of the refine() calls not read back yet
+	GLuint preview_tex = 0;
+	GLuint preview_biome_tex = 0;
+	GLuint preview_slope_tex = 0;
+	glm::uvec2 preview_size = glm::uvec2(0);
+	unsigned int preview_spacing = 1;
+	std::vector<glm::uvec2> refine_tiles;
+	unsigned int refine_total = 0;
+	// channels the tiles are refined in
+	unsigned int refine_channels = ALL_CHANNELS;
+	struct RefineTimer {
+		GLuint query;
+		unsigned int tiles;
+		double cpu_ms;
+	};
+	std::vector<RefineTimer> refine_timers;
+	std::vector<GLuint> free_refine_queries;
+	double refine_tile_ms = 0.0;
 
-	void gen_data();
-	void gen_vertices();
+	void gen_data(const Terrain* previous);
+	// uploads the size texels at origin from the cache entry of the current settings, false if there is none or it
+	// is damaged
+	bool load_cached(glm::uvec2 origin, glm::uvec2 size);
+	// writes the whole heightmap to the cache as the entry of the current settings
+	void store_cached();
+	// copies the data both terrains cover from previous, if it was generated with the same settings and format
+	void reuse_data(const Terrain* previous);
+	// generates rows [first, first + count) of the heightmap, but the reused block
+	void generate_rows(unsigned int first, unsigned int count);
+	// generates the given channels of the size texels at origin
+	void generate_region(glm::uvec2 origin, glm::uvec2 size, unsigned int channels = ALL_CHANNELS);
+	// points the generator's slope output at tex, the slopes are then written with the height
+	void bind_slope_image(GLuint tex);
 	void gen_buffers();
+	// (re)creates the VBO and EBO of patch_layout and vertex_format and points the VAO at them
+	void gen_patch_buffers();
+	void gen_cdlod_mesh();
+	// draws the patches of the tessellation renderer, the ones cull() kept or all of them
+	void draw_patches();
+	// picks the CDLOD nodes for the eye and uploads their instances
+	void select_lod_nodes(const Frustum& frustum, const glm::vec3& eye);
+	void set_cdlod_uniforms(Camera* camera, const glm::mat4& view_projection);
+	void gen_bounds();
+	void create_bounds_textures();
+	void gen_roughness();
+	void create_roughness_buffer();
+	// estimates the roughness of the count.x x count.y patches starting at patch first (i, j), with the given sample
+	// points per patch side or 0 for one per texel
+	void estimate_roughness(glm::uvec2 first, glm::uvec2 count, int samples = 0);
+	// units of work in a build stage
+	unsigned int get_build_units(BuildStage stage) const;
+	// runs up to count units of the current stage, returns how many it did
+	unsigned int build_slice(unsigned int count);
+	// generates the preview and stretches it over the heightmap
+	void gen_preview();
+	// generates the tile at the given texel origin at full resolution and updates the bounds and roughness it affects,
+	// except for the patch ranges of the pre-pass
+	void refine_tile(glm::uvec2 origin);
+	// re-estimates the roughness of the patches that sample any of the size texels at origin: the ones over them plus a
+	// ring, as the filtered samples on a patch edge read a texel of the patch next to it
+	void update_roughness(glm::uvec2 origin, glm::uvec2 size);
+	// moves the heightmap so texel t takes the height of texel t + delta, as an offset change of delta does, generates
+	// the texels it exposes and updates the bounds and roughness
+	void shift_height(glm::ivec2 delta);
+	void gen_tess_buffers();
+	// uploads the patch height ranges of the pyramid for the pre-pass
+	void upload_patch_ranges();
+	// runs the pre-pass for the given view
+	void compute_tess_factors(const glm::mat4& view, const glm::mat4& view_projection);
+	// runs the reduction over the given inclusive rectangle of level 0 cells and all their ancestors, then reads the
+	// updated cells back into height_pyramid
+	void reduce_bounds(glm::uvec4 cells);
+	// world-space bounds of the texel-space rectangle [x0, x1] x [y0, y1]
+	AABB get_bounds(float x0, float y0, float x1, float y1) const;
 
 public:
 	// keep em public cause its easier to manage
@@ -53,9 +234,134 @@ public:
 	int max_tess_level = 64;
 	float min_distance = 25;
 	float max_distance = 500;
+	// pick tessellation levels from the per patch roughness, keeping the projected height error under pixel_error pixels,
+	// instead of interpolating between min and max level by distance
+	bool screen_space_error = true;
+	float pixel_error = 1.0f;
+	// diffuse lighting with the normals of the generated slopes, which the vertices read along with the height
+	bool lighting = true;
+	// how cull() finds the patches inside the view frustum, draw() then only submits those
+	enum Culling {
+		NO_CULLING,
+		FLAT_CULLING,		// every patch tested, see PatchCuller::cull_flat()
+		QUADTREE_CULLING,	// hierarchical, see PatchCuller::cull_quadtree()
+		PREPASS_CULLING		// no CPU work: every patch is submitted and the tessellation pre-pass zeroes the levels of the culled ones
+	};
+	Culling culling = QUADTREE_CULLING;
 
-	Terrain(unsigned int width, unsigned int height, unsigned int resolution, Shader* shader, ComputeShader* generator, NoiseSettings noise_settings);
+	// how the terrain surface is built
+	enum RenderMode {
+		TESSELLATION,	// patches tessellated on the GPU (terrain_lod.tesc/.tese)
+		CDLOD			// quadtree nodes selected on the CPU, each an instance of one grid mesh morphed in cdlod.vert
+	};
+	RenderMode render_mode = TESSELLATION;
+	// quads per side of the CDLOD grid mesh, one node of any level draws that many
+	static const unsigned int CDLOD_GRID_SIZE = 32;
+	// distance up to which the finest CDLOD level (the patches) is used, doubling with every level; raised to the shortest
+	// crack free range when below it
+	float lod_distance = 256.0f;
+	// fraction of a level's range after which its vertices start morphing into the next level, in [0.1, 0.95]
+	float morph_start = 0.7f;
+	// upper bound on the CDLOD triangles, enforced by shrinking the ranges down to the shortest one; 0 for none
+	unsigned int triangle_budget = 0;
+
+	// deferred only allocates the textures and leaves the rest to build(), for building a terrain across frames while
+	// another one is drawn. A previous terrain with the same noise settings and format, built and refined, lends the
+	// block of data both cover (their samples only depend on the texel coordinates) instead of it being generated again.
+	// With a cache holding the settings the whole heightmap is loaded from it instead, see set_cache().
+	Terrain(unsigned int width, unsigned int height, unsigned int resolution, Shader* shader, Shader* cdlod_shader, ComputeShader* generator, ComputeShader* bounds_reducer, ComputeShader* roughness_estimator, ComputeShader* tess_estimator, NoiseSettings noise_settings, DataFormat data_format = FULL, bool deferred = false, const Terrain* previous = nullptr, TerrainCache* cache = nullptr);
 	~Terrain();
-	void draw(); // draw full mesh
+	// Continues a deferred build for about budget_ms, returns true once the terrain can be drawn. The work is split into
+	// slices sized from the measured cost of the previous ones, each waited for with a fence, so the time spent here
+	// includes the GPU's and stays in this frame; at least one slice runs per call.
+	bool build(double budget_ms);
+	bool is_built() const { return build_stage == BUILD_DONE; }
+	// fraction of the build done, by stage
+	float get_build_progress() const;
+	// frames and total time the deferred build took
+	unsigned int get_build_frames() const { return build_frames; }
+	double get_build_time() const { return build_ms; }
+
+	// side in texels of the tiles refine() regenerates, the tiles of a TerrainCache entry too so each is loaded whole
+	static const unsigned int REFINE_TILE_SIZE = 256;
+	// samples per side of the preview regenerate() starts from, at most
+	static const unsigned int PREVIEW_SIZE = 512;
+	// Regenerates the data with new noise settings, only in the channels whose settings changed (see
+	// changed_channels()), coarse to fine. Within this call a preview of PREVIEW_SIZE samples per side is generated and
+	// stretched over the whole heightmap with linear filtering, and the bounds and a coarse roughness estimate follow it,
+	// so the terrain can be drawn with the new settings in the next frame. refine() then replaces the preview tile by
+	// tile. With FULL storage the preview is only stretched when every channel changed, as the channels share texels.
+	// A change of the height offset by whole texels in x and y alone shifts the heightmap instead and generates just
+	// the texels it exposes, at once; otherwise settings the cache holds are loaded from it by refine() in place of
+	// generating the tiles, every channel of them. A deferred build still running starts over with the new settings
+	// instead.
+	void regenerate(const NoiseSettings& settings);
+	// channels whose data differs between the two settings
+	static unsigned int changed_channels(const NoiseSettings& from, const NoiseSettings& to);
+	// Generates (or loads from the cache) the tiles still showing the preview at full resolution, nearest to the eye
+	// first, for about budget_ms per call. The cost of a tile is read from timer queries once they are available, a frame or more later, so the first
+	// call after a regenerate() refines a single tile. Returns true once every tile is done, and then the
+	// heightmap, bounds and roughness are the same a terrain built with these settings at once has.
+	bool refine(const glm::vec3& eye, double budget_ms);
+	bool is_refined() const { return refine_tiles.empty(); }
+	// fraction of the tiles refined since the last regenerate()
+	float get_refine_progress() const { return refine_total > 0 ? 1.0f - (float)refine_tiles.size() / refine_total : 1.0f; }
+	// GPU time of a refined tile, averaged over the last calls
+	double get_refine_tile_time() const { return refine_tile_ms; }
+	void draw(); // draw full mesh, or the visible patches when frustum culling
+	// finds the patches inside the frustum of view_projection and prepares the indirect draw of draw(), or selects the
+	// CDLOD nodes for an eye at the given position
+	void cull(const glm::mat4& view_projection, const glm::vec3& eye);
+	unsigned int get_num_patches() const { return resolution * resolution; }
+	bool culls_on_cpu() const { return culling == FLAT_CULLING || culling == QUADTREE_CULLING; }
+	// patches submitted to the GPU
+	unsigned int get_num_visible_patches() const { return culls_on_cpu() ? num_visible_patches : get_num_patches(); }
+	// CPU time of the last cull() in ms
+	double get_culling_time() const { return render_mode == CDLOD || culls_on_cpu() ? culling_ms : 0.0; }
+	// CDLOD nodes selected by the last cull() and the triangles they draw
+	unsigned int get_num_lod_nodes() const { return (unsigned int)lod_nodes.size(); }
+	GLuint64 get_lod_triangles() const { return (GLuint64)lod_nodes.size() * CDLOD_GRID_SIZE * CDLOD_GRID_SIZE * 2; }
+	// ratio of the CDLOD ranges used in the last cull() to the ones lod_distance asks for
+	float get_lod_range_scale() const { return lod_ranges.empty() ? 1.0f : lod_ranges[0] / lod_distance; }
+	const PatchCuller& get_patch_culler() const { return patch_culler; }
+	// triangles the tessellator generated for the terrain in a recent frame
+	GLuint64 get_triangles() const { return triangles; }
+	// sets the per frame uniforms and runs the tessellation factor pre-pass for this view
 	void set_uniforms(Camera* camera, glm::mat4 view_projection);
+
+	PatchLayout get_patch_layout() const { return patch_layout; }
+	// rebuilds the patch buffers in the given layout, the drawn mesh stays the same
+	void set_patch_layout(PatchLayout layout);
+	VertexFormat get_vertex_format() const { return vertex_format; }
+	void set_vertex_format(VertexFormat format);
+	// bytes of GPU memory taken by the patch vertices and indices
+	size_t get_patch_buffer_size() const { return patch_buffer_size; }
+
+	// Terrain data cache to load from and store to, nullptr for none. Maps are stored once generated in full: at the
+	// end of a build, or once refine() is done; the heightmaps of a shift are not.
+	void set_cache(TerrainCache* cache) { this->cache = cache; }
+	TerrainCache* get_cache() const { return cache; }
+
+	DataFormat get_data_format() const { return data_format; }
+	// bytes of GPU memory taken by the generated channels
+	size_t get_data_size() const;
+
+	const HeightPyramid& get_height_pyramid() const { return height_pyramid; }
+	// world-space bounds of patch (i, j), i running along x and j along z, at the current height scale and shift
+	AABB get_patch_bounds(unsigned int i, unsigned int j) const;
+	// bounds of quadtree node (i, j) of the given level, covering 2^level x 2^level patches (clipped to the patch grid)
+	AABB get_node_bounds(unsigned int level, unsigned int i, unsigned int j) const;
+	// levels of the patch quadtree, the last one being a single node over the whole terrain
+	unsigned int get_num_node_levels() const;
+	// refreshes the bounds after the w x h texels at (x, y) of the terrain data were rewritten
+	void update_bounds(unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+
+	// binds the generator and uploads the noise parameters
+	static void set_generator_uniforms(ComputeShader* generator, const NoiseSettings& settings);
+	// #defines the generator has to be compiled with to write the given format
+	static std::string generator_prelude(DataFormat format);
+	// allocates the textures of the given format; biome_tex is left at 0 for FULL
+	static void create_data_textures(unsigned int width, unsigned int height, DataFormat format, GLuint& data_tex, GLuint& biome_tex);
+	// binds the textures to the image units the generator writes to
+	static void bind_data_images(DataFormat format, GLuint data_tex, GLuint biome_tex);
 };
\ No newline at end of file
@@ -0,0 +1,471 @@
+#include "terrain_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	// header of a tile file, followed by the texels of every plane
+	struct TileHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t width;
+		uint32_t height;
+		uint32_t format;
+		// of the texels, see checksum()
+		uint32_t checksum;
+	};
+	const char TILE_MAGIC[4] = { 'T', 'L', 'O', 'D' };
+
+	// a texture of the terrain as stored in the tiles
+	struct TexturePlane {
+		GLuint tex;
+		GLenum format;
+		GLenum type;
+		unsigned int texel_bytes;
+	};
+
+	// the planes of a storage format in file order: the channels, then the slopes (read back as halfs, bit exact)
+	unsigned int get_planes(const TerrainCache::Textures& textures, TexturePlane (&planes)[3])
+	{
+		unsigned int count = 0;
+		if (textures.format == Terrain::PACKED) {
+			planes[count++] = { textures.data_tex, GL_RED, GL_UNSIGNED_SHORT, 2 };
+			planes[count++] = { textures.biome_tex, GL_RG, GL_UNSIGNED_BYTE, 2 };
+		}
+		else
+			planes[count++] = { textures.data_tex, GL_RGBA, GL_FLOAT, 16 };
+		planes[count++] = { textures.slope_tex, GL_RG, GL_HALF_FLOAT, 4 };
+		return count;
+	}
+
+	// FNV-1a
+	const uint64_t HASH_SEED = 14695981039346656037ull;
+	uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+	template <class T>
+	uint64_t hash_value(uint64_t hash, T value) { return hash_bytes(hash, &value, sizeof(value)); }
+
+	// FNV-1a over 8 byte words rather than bytes, fast enough to check every tile loaded; the halves folded together
+	uint32_t checksum(const unsigned char* data, size_t size)
+	{
+		uint64_t hash = HASH_SEED;
+		size_t words = size / 8;
+		for (size_t i = 0; i < words; i++) {
+			uint64_t word;
+			memcpy(&word, data + i * 8, 8);
+			hash ^= word;
+			hash *= 1099511628211ull;
+		}
+		hash = hash_bytes(hash, data + words * 8, size % 8);
+		return (uint32_t)(hash ^ (hash >> 32));
+	}
+
+	std::string tile_name(unsigned int x, unsigned int y)
+	{
+		return std::to_string(x / TerrainCache::TILE_SIZE) + "_" + std::to_string(y / TerrainCache::TILE_SIZE) + ".tile";
+	}
+
+	bool make_directory(const std::string& path)
+	{
+#ifdef _WIN32
+		return _mkdir(path.c_str()) == 0 || GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+		struct stat info;
+		return mkdir(path.c_str(), 0755) == 0 || (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode));
+#endif
+	}
+
+	// names in the directory, without . and ..
+	std::vector<std::string> list_directory(const std::string& path)
+	{
+		std::vector<std::string> names;
+#ifdef _WIN32
+		WIN32_FIND_DATAA found;
+		HANDLE search = FindFirstFileA((path + "\\*").c_str(), &found);
+		if (search == INVALID_HANDLE_VALUE)
+			return names;
+		do {
+			names.push_back(found.cFileName);
+		} while (FindNextFileA(search, &found));
+		FindClose(search);
+#else
+		DIR* dir = opendir(path.c_str());
+		if (dir == nullptr)
+			return names;
+		while (dirent* entry = readdir(dir))
+			names.push_back(entry->d_name);
+		closedir(dir);
+#endif
+		names.erase(std::remove_if(names.begin(), names.end(), [](const std::string& name) { return name == "." || name == ".."; }), names.end());
+		return names;
+	}
+
+	// removes the directory and the files in it
+	void remove_directory(const std::string& path)
+	{
+		for (auto& name : list_directory(path))
+			std::remove((path + "/" + name).c_str());
+#ifdef _WIN32
+		_rmdir(path.c_str());
+#else
+		rmdir(path.c_str());
+#endif
+	}
+}
+
+TerrainCache::TerrainCache(const std::string& directory, const std::string& generator_path, uint64_t max_bytes)
+	: max_bytes(max_bytes), directory(directory)
+{
+	if (!make_directory(directory))
+		std::cout << "Failed to create the terrain cache directory " << directory << std::endl;
+	std::ifstream file(generator_path, std::ios::binary);
+	std::stringstream source;
+	source << file.rdbuf();
+	if (!file)
+		std::cout << "Failed to read the generator source " << generator_path << " for the terrain cache" << std::endl;
+	std::string text = source.str();
+	generator_hash = hash_bytes(HASH_SEED, text.data(), text.size());
+	update_size();
+	std::cout << "Terrain cache: " << num_entries << " entries, " << size / (1024 * 1024) << " MiB in " << directory << std::endl;
+}
+
+TerrainCache::~TerrainCache()
+{
+	finish();
+}
+
+uint64_t TerrainCache::make_key(const NoiseSettings& settings, unsigned int width, unsigned int height, Terrain::DataFormat format) const
+{
+	uint64_t hash = hash_value(generator_hash, FORMAT_VERSION);
+	hash = hash_value(hash, TILE_SIZE);
+	hash = hash_value(hash, width);
+	hash = hash_value(hash, height);
+	hash = hash_value(hash, (uint32_t)format);
+	// field by field, the struct has padding
+	hash = hash_value(hash, settings.offset.x);
+	hash = hash_value(hash, settings.offset.y);
+	hash = hash_value(hash, settings.offset.z);
+	hash = hash_value(hash, settings.frequency);
+	hash = hash_value(hash, settings.octaves);
+	hash = hash_value(hash, settings.amplitude);
+	hash = hash_value(hash, settings.lacunarity);
+	hash = hash_value(hash, settings.gain);
+	hash = hash_value(hash, settings.range);
+	hash = hash_value(hash, settings.biome_frequency);
+	hash = hash_value(hash, settings.biome_octaves);
+	hash = hash_value(hash, settings.biome_amplitude);
+	hash = hash_value(hash, settings.biome_lacunarity);
+	hash = hash_value(hash, settings.biome_gain);
+	hash = hash_value(hash, settings.biome_range);
+	hash = hash_value(hash, settings.band_limit);
+	return hash;
+}
+
+std::string TerrainCache::entry_path(uint64_t key) const
+{
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+	return directory + "/" + name;
+}
+
+bool TerrainCache::contains(uint64_t key) const
+{
+	return std::ifstream(entry_path(key) + "/entry").good();
+}
+
+size_t TerrainCache::tile_file_size(Terrain::DataFormat format, unsigned int w, unsigned int h)
+{
+	// the texel sizes of get_planes()
+	return sizeof(TileHeader) + (size_t)w * h * ((format == Terrain::PACKED ? 4 : 16) + 4);
+}
+
+bool TerrainCache::load(uint64_t key, const Textures& textures, unsigned int width, unsigned int height, glm::uvec2 origin, glm::uvec2 size)
+{
+	if (!contains(key))
+		return false;
+	std::string path = entry_path(key);
+	TexturePlane planes[3];
+	unsigned int num_planes = get_planes(textures, planes);
+	glm::uvec2 end = origin + size;
+	bool ok = true;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (unsigned int ty = origin.y / TILE_SIZE * TILE_SIZE; ok && ty < end.y; ty += TILE_SIZE)
+		for (unsigned int tx = origin.x / TILE_SIZE * TILE_SIZE; ok && tx < end.x; tx += TILE_SIZE) {
+			glm::uvec2 tile(std::min(TILE_SIZE, width - tx), std::min(TILE_SIZE, height - ty));
+			MappedFile file;
+			ok = file.open(path + "/" + tile_name(tx, ty)) && file.get_size() == tile_file_size(textures.format, tile.x, tile.y);
+			if (!ok)
+				break;
+			const TileHeader* header = (const TileHeader*)file.get_data();
+			ok = memcmp(header->magic, TILE_MAGIC, 4) == 0 && header->version == FORMAT_VERSION && header->key == key
+				&& header->width == tile.x && header->height == tile.y && header->format == (uint32_t)textures.format;
+			// the whole tile, by the load that takes in its first row: a load in row slices checks each tile once
+			if (ok && origin.y <= ty)
+				ok = checksum(file.get_data() + sizeof(TileHeader), file.get_size() - sizeof(TileHeader)) == header->checksum;
+			if (!ok)
+				break;
+			// the part of the tile inside the rectangle
+			glm::uvec2 first = glm::max(origin, glm::uvec2(tx, ty));
+			glm::uvec2 last = glm::min(end, glm::uvec2(tx, ty) + tile);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, tile.x);
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, first.x - tx);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, first.y - ty);
+			const unsigned char* texels = file.get_data() + sizeof(TileHeader);
+			for (unsigned int p = 0; p < num_planes; p++) {
+				glTextureSubImage2D(planes[p].tex, 0, first.x, first.y, last.x - first.x, last.y - first.y, planes[p].format, planes[p].type, texels);
+				texels += (size_t)tile.x * tile.y * planes[p].texel_bytes;
+			}
+		}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (!ok) {
+		std::cout << "Damaged terrain cache entry " << path << ", removing it" << std::endl;
+		remove(key);
+		return false;
+	}
+	if (origin == glm::uvec2(0)) {
+		// rewritten with the current time
+		std::ifstream entry(path + "/entry");
+		uint64_t bytes = 0;
+		entry >> bytes;
+		entry.close();
+		write_entry_file(path + "/entry", bytes);
+	}
+	return true;
+}
+
+bool TerrainCache::store(uint64_t key, const Textures& textures, unsigned int width, unsigned int height)
+{
+	for (auto& store : pending)
+		if (store->key == key)
+			return true;
+	uint64_t bytes = 0;
+	unsigned int num_tiles = 0;
+	for (unsigned int ty = 0; ty < height; ty += TILE_SIZE)
+		for (unsigned int tx = 0; tx < width; tx += TILE_SIZE) {
+			bytes += tile_file_size(textures.format, std::min(TILE_SIZE, width - tx), std::min(TILE_SIZE, height - ty));
+			num_tiles++;
+		}
+	if (bytes > max_bytes)
+		return false;
+	std::string path = entry_path(key);
+	remove_directory(path);
+	// the pending entries have no entry file yet, their bytes aren't counted otherwise
+	uint64_t reserve = bytes;
+	for (auto& store : pending)
+		reserve += store->bytes;
+	evict(reserve);
+	if (!make_directory(path)) {
+		std::cout << "Failed to create terrain cache entry " << path << std::endl;
+		return false;
+	}
+
+	std::unique_ptr<PendingStore> store(new PendingStore());
+	store->key = key;
+	store->format = textures.format;
+	store->width = width;
+	store->height = height;
+	store->bytes = bytes;
+	store->buffer_bytes = (size_t)(bytes - (uint64_t)num_tiles * sizeof(TileHeader));
+	store->start = std::chrono::steady_clock::now();
+	glCreateBuffers(1, &store->buffer);
+	// read on the CPU only, so kept in client memory
+	glNamedBufferStorage(store->buffer, store->buffer_bytes, nullptr, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+
+	// the copies are queued behind the commands that wrote the textures, nothing waits for them here
+	TexturePlane planes[3];
+	unsigned int num_planes = get_planes(textures, planes);
+	size_t offset = 0;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, store->buffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (unsigned int ty = 0; ty < height; ty += TILE_SIZE)
+		for (unsigned int tx = 0; tx < width; tx += TILE_SIZE) {
+			glm::uvec2 tile(std::min(TILE_SIZE, width - tx), std::min(TILE_SIZE, height - ty));
+			for (unsigned int p = 0; p < num_planes; p++) {
+				GLsizei plane_bytes = (GLsizei)((size_t)tile.x * tile.y * planes[p].texel_bytes);
+				glGetTextureSubImage(planes[p].tex, 0, tx, ty, 0, tile.x, tile.y, 1, planes[p].format, planes[p].type, plane_bytes, (void*)offset);
+				offset += plane_bytes;
+			}
+		}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	store->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	pending.push_back(std::move(store));
+	return true;
+}
+
+void TerrainCache::update()
+{
+	for (auto it = pending.begin(); it != pending.end();) {
+		if (advance(**it, false))
+			it = pending.erase(it);
+		else
+			++it;
+	}
+}
+
+void TerrainCache::finish()
+{
+	for (auto& store : pending)
+		advance(*store, true);
+	pending.clear();
+}
+
+bool TerrainCache::advance(PendingStore& store, bool wait)
+{
+	std::string path = entry_path(store.key);
+	if (!store.writer.joinable()) {
+		GLenum status = glClientWaitSync(store.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (wait && status == GL_TIMEOUT_EXPIRED)
+			status = glClientWaitSync(store.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		if (status == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(store.fence);
+		store.fence = 0;
+		// the copy is done, mapping doesn't stall; the buffer stays mapped until the worker is
+		const unsigned char* texels = (const unsigned char*)glMapNamedBufferRange(store.buffer, 0, store.buffer_bytes, GL_MAP_READ_BIT);
+		store.mapped = texels != nullptr;
+		PendingStore* target = &store;
+		store.writer = std::thread([path, target, texels]() {
+			target->ok = texels != nullptr && write_tiles(path, *target, texels);
+			target->written = true;
+		});
+	}
+	if (!wait && !store.written)
+		return false;
+	store.writer.join();
+	if (store.mapped)
+		glUnmapNamedBuffer(store.buffer);
+	glDeleteBuffers(1, &store.buffer);
+	if (!store.ok) {
+		std::cout << "Failed to write terrain cache entry " << path << std::endl;
+		remove_directory(path);
+		update_size();
+		return true;
+	}
+	// the entry file makes the entry complete
+	write_entry_file(path + "/entry", store.bytes);
+	update_size();
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - store.start;
+	std::cout << "Stored terrain data in the cache in " << elapsed.count() << " ms, " << store.bytes / (1024 * 1024) << " MiB" << std::endl;
+	return true;
+}
+
+bool TerrainCache::write_tiles(const std::string& path, const PendingStore& store, const unsigned char* texels)
+{
+	for (unsigned int ty = 0; ty < store.height; ty += TILE_SIZE)
+		for (unsigned int tx = 0; tx < store.width; tx += TILE_SIZE) {
+			glm::uvec2 tile(std::min(TILE_SIZE, store.width - tx), std::min(TILE_SIZE, store.height - ty));
+			size_t file_size = tile_file_size(store.format, tile.x, tile.y);
+			MappedFile file;
+			if (!file.create(path + "/" + tile_name(tx, ty), file_size))
+				return false;
+			TileHeader header = {};
+			memcpy(header.magic, TILE_MAGIC, 4);
+			header.version = FORMAT_VERSION;
+			header.key = store.key;
+			header.width = tile.x;
+			header.height = tile.y;
+			header.format = (uint32_t)store.format;
+			header.checksum = checksum(texels, file_size - sizeof(TileHeader));
+			memcpy(file.get_data(), &header, sizeof(header));
+			memcpy(file.get_data() + sizeof(TileHeader), texels, file_size - sizeof(TileHeader));
+			texels += file_size - sizeof(TileHeader);
+		}
+	return true;
+}
+
+void TerrainCache::remove(uint64_t key)
+{
+	remove_directory(entry_path(key));
+	update_size();
+}
+
+void TerrainCache::clear()
+{
+	finish();
+	for (auto& entry : list_entries())
+		remove_directory(directory + "/" + entry.name);
+	update_size();
+}
+
+std::vector<TerrainCache::Entry> TerrainCache::list_entries() const
+{
+	std::vector<Entry> entries;
+	for (auto& name : list_directory(directory)) {
+		// entries are named after their key in hex
+		if (name.size() != 16 || name.find_first_not_of("0123456789abcdef") != std::string::npos)
+			continue;
+		Entry entry = { name, 0, 0 };
+		std::ifstream file(directory + "/" + name + "/entry");
+		file >> entry.bytes >> entry.last_used;
+		if (!file)
+			entry.last_used = 0;
+		entries.push_back(entry);
+	}
+	return entries;
+}
+
+void TerrainCache::evict(uint64_t reserve)
+{
+	std::vector<Entry> entries = list_entries();
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.last_used < b.last_used; });
+	uint64_t total = 0;
+	for (auto& entry : entries)
+		total += entry.bytes;
+	for (auto& entry : entries) {
+		// still being written
+		auto writing = [this, &entry](const std::unique_ptr<PendingStore>& store) { return entry_path(store->key) == directory + "/" + entry.name; };
+		if (std::any_of(pending.begin(), pending.end(), writing))
+			continue;
+		// incomplete entries sort first and are always removed
+		if (entry.last_used != 0 && total + reserve <= max_bytes)
+			break;
+		remove_directory(directory + "/" + entry.name);
+		total -= entry.bytes;
+		std::cout << "Evicted terrain cache entry " << entry.name << std::endl;
+	}
+}
+
+void TerrainCache::update_size()
+{
+	size = 0;
+	num_entries = 0;
+	for (auto& entry : list_entries())
+		if (entry.last_used != 0) {
+			size += entry.bytes;
+			num_entries++;
+		}
+}
+
+void TerrainCache::write_entry_file(const std::string& path, uint64_t bytes)
+{
+	std::ofstream file(path);
+	file << bytes << " " << (uint64_t)std::time(nullptr) << std::endl;
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "noise_settings.h"
+#include "terrain.h"
+
+// Content-addressed cache of generated terrain data on disk, so a map generated once is loaded instead of generated
+// again, on later runs too.
+// An entry holds the textures of one Terrain (the channels in its storage format and the slopes) and is keyed by a hash
+// of everything its texels depend on: the noise settings, the map size, the storage format and the generator's source.
+// It is a directory named after the key, holding one file per TILE_SIZE tile of the map (a small header with a checksum
+// of the texels, followed by the raw texels of every texture in upload order) and an "entry" file written last, which
+// marks the entry complete and records its size and when it was last used. Tiles are memory mapped and uploaded
+// straight from the mapping.
+// Storing copies the textures into a pixel buffer on the GPU and returns; once update() finds the copy done, a worker
+// thread writes the tile files from the mapped buffer, so neither the readback nor the disk holds up a frame.
+// Entries are evicted least recently used first whenever storing one would take the cache over max_bytes.
+class TerrainCache {
+public:
+	// side in texels of the tiles an entry is split into
+	static const unsigned int TILE_SIZE = 256;
+	// bumped whenever the layout of the tile files changes
+	static const uint32_t FORMAT_VERSION = 2;
+
+	// the textures of a terrain an entry is loaded into and stored from
+	struct Textures {
+		Terrain::DataFormat format;
+		GLuint data_tex;
+		// PACKED storage only
+		GLuint biome_tex;
+		GLuint slope_tex;
+	};
+
+	// total size the entries may take, an entry bigger than this is not stored
+	uint64_t max_bytes;
+
+	// Keeps the entries in directory, created if missing. generator_path is the source of the generator
+	// (shaders/terrain_gen.comp), hashed into every key so a changed generator never loads stale data.
+	TerrainCache(const std::string& directory, const std::string& generator_path, uint64_t max_bytes);
+	// waits for the pending stores
+	~TerrainCache();
+
+	uint64_t make_key(const NoiseSettings& settings, unsigned int width, unsigned int height, Terrain::DataFormat format) const;
+	// whether a complete entry exists for the key
+	bool contains(uint64_t key) const;
+	// Uploads the texels of the entry in the size rectangle at origin of the map into the textures, which have the
+	// map's size; a load starting at the map's origin marks the entry as used. A tile's checksum is verified by the load
+	// whose rectangle takes in the tile's first row. Returns false if the entry is missing or a tile is damaged (wrong
+	// size, header or checksum), the entry is then removed and the rectangle left partly written.
+	bool load(uint64_t key, const Textures& textures, unsigned int width, unsigned int height, glm::uvec2 origin, glm::uvec2 size);
+	// Starts writing the whole width x height map of the textures as the entry of the key, evicting older entries as
+	// needed. The texels are copied before it returns, the textures may change right after; the entry is complete once
+	// update() finished it. False if the entry can't be stored.
+	bool store(uint64_t key, const Textures& textures, unsigned int width, unsigned int height);
+	// hands the stores whose copy is done to their worker and completes the written ones; call once per frame
+	void update();
+	// waits for the pending stores and completes them
+	void finish();
+	void remove(uint64_t key);
+	// removes every entry, after the pending stores
+	void clear();
+
+	// bytes taken by the complete entries and their count
+	uint64_t get_size() const { return size; }
+	unsigned int get_num_entries() const { return num_entries; }
+	unsigned int get_num_pending() const { return (unsigned int)pending.size(); }
+	const std::string& get_directory() const { return directory; }
+
+private:
+	struct Entry {
+		std::string name;
+		uint64_t bytes;
+		// seconds since the epoch, 0 for an entry without its entry file
+		uint64_t last_used;
+	};
+
+	// an entry on its way from the textures to its files
+	struct PendingStore {
+		uint64_t key;
+		Terrain::DataFormat format;
+		unsigned int width, height;
+		// of the entry's files
+		uint64_t bytes;
+		// the texels of every tile in file order, without the headers; mapped while the writer runs
+		GLuint buffer = 0;
+		size_t buffer_bytes = 0;
+		bool mapped = false;
+		// signalled once the copy into buffer is done
+		GLsync fence = 0;
+		std::thread writer;
+		std::atomic<bool> written{ false };
+		bool ok = false;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	std::string directory;
+	uint64_t generator_hash;
+	uint64_t size = 0;
+	unsigned int num_entries = 0;
+	std::vector<std::unique_ptr<PendingStore>> pending;
+
+	std::string entry_path(uint64_t key) const;
+	std::vector<Entry> list_entries() const;
+	// removes the incomplete entries but the pending ones, and the least recently used ones until the rest fit in
+	// max_bytes - reserve
+	void evict(uint64_t reserve);
+	// moves the store on; with wait, until it is complete. True once it is
+	bool advance(PendingStore& store, bool wait);
+	// writes the tile files of the store from its texels, false if one can't be written
+	static bool write_tiles(const std::string& path, const PendingStore& store, const unsigned char* texels);
+	// recounts size and num_entries
+	void update_size();
+	static void write_entry_file(const std::string& path, uint64_t bytes);
+	// bytes of a tile file of w x h texels
+	static size_t tile_file_size(Terrain::DataFormat format, unsigned int w, unsigned int h);
+};
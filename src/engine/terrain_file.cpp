@@ -0,0 +1,332 @@
+#include "terrain_file.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
+
+static const char FILE_MAGIC[4] = { 'T', 'L', 'T', 'F' };
+
+// bytes per texel of every channel
+static const unsigned int TEXEL_BYTES[TerrainFile::NUM_CHANNELS] = { 2, 2, 4 };
+
+tile_codec::Layout TerrainFile::get_layout(Channel channel, glm::uvec2 size)
+{
+	switch (channel) {
+	case HEIGHT:
+		return { size.x, size.y, 1, 2 };
+	case BIOME:
+		return { size.x, size.y, 2, 1 };
+	default:
+		return { size.x, size.y, 2, 2 };
+	}
+}
+
+unsigned int TerrainFile::get_height_error_steps(float world_error, float height_scale)
+{
+	if (!(world_error > 0.0f && height_scale > 0.0f))
+		return 0;
+	return (unsigned int)std::min(std::floor(world_error / height_scale * 65535.0f), 65535.0f);
+}
+
+bool TerrainFile::read_header(const Header& header)
+{
+	static_assert(sizeof(Header) == 104 && sizeof(Slot) == 24, "the file structures have no padding");
+	if (memcmp(header.magic, FILE_MAGIC, 4) != 0 || header.version != VERSION || header.width == 0 || header.height == 0
+		|| header.width > MAX_SIZE || header.height > MAX_SIZE || header.tile_size < 2 || header.tile_size % 2 != 0
+		|| header.tile_size > MAX_TILE_SIZE || header.num_levels == 0 || header.num_levels > 32)
+		return false;
+	width = header.width;
+	height = header.height;
+	tile_size = header.tile_size;
+	num_levels = header.num_levels;
+	settings = NoiseSettings(glm::vec3(header.offset[0], header.offset[1], header.offset[2]), header.frequency, header.octaves,
+		header.amplitude, header.lacunarity, header.gain, header.range);
+	settings.biome_frequency = header.biome_frequency;
+	settings.biome_octaves = header.biome_octaves;
+	settings.biome_amplitude = header.biome_amplitude;
+	settings.biome_lacunarity = header.biome_lacunarity;
+	settings.biome_gain = header.biome_gain;
+	settings.biome_range = header.biome_range;
+	settings.band_limit = header.band_limit != 0;
+	level_slots.assign(1, 0);
+	for (unsigned int level = 0; level < num_levels; level++) {
+		glm::uvec2 count = get_tile_count(level);
+		level_slots.push_back(level_slots.back() + (size_t)count.x * count.y * NUM_CHANNELS);
+	}
+	return true;
+}
+
+bool TerrainFile::fits_index(const Header& header, uint64_t file_size) const
+{
+	// divided rather than multiplied, a damaged header can't wrap the end of the index around
+	return header.index_offset >= sizeof(Header) && header.index_offset % 8 == 0 && header.index_offset <= file_size
+		&& get_num_slots() <= (file_size - header.index_offset) / sizeof(Slot);
+}
+
+bool TerrainFile::open(const std::string& path)
+{
+	close();
+	// a region or a far tile is a few scattered slots, read-ahead would only fetch tiles nobody asked for
+	if (!file.open(path, MappedFile::RANDOM) || file.get_size() < sizeof(Header))
+		return false;
+	Header header;
+	memcpy(&header, file.get_data(), sizeof(header));
+	if (!read_header(header) || !fits_index(header, file.get_size())) {
+		close();
+		return false;
+	}
+	index = (const Slot*)(file.get_data() + header.index_offset);
+	return true;
+}
+
+void TerrainFile::close()
+{
+	file.close();
+	index = nullptr;
+	width = height = tile_size = num_levels = 0;
+	level_slots.clear();
+}
+
+glm::uvec2 TerrainFile::get_level_size(unsigned int level) const
+{
+	return (glm::uvec2(width, height) + (1u << level) - 1u) >> level;
+}
+
+glm::uvec2 TerrainFile::get_tile_count(unsigned int level) const
+{
+	return (get_level_size(level) + tile_size - 1u) / tile_size;
+}
+
+glm::uvec2 TerrainFile::get_tile_texels(unsigned int level, unsigned int tx, unsigned int ty) const
+{
+	glm::uvec2 origin = glm::uvec2(tx, ty) * tile_size;
+	return glm::min(glm::uvec2(tile_size), get_level_size(level) - origin);
+}
+
+size_t TerrainFile::get_slot(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const
+{
+	return level_slots[level] + ((size_t)ty * get_tile_count(level).x + tx) * NUM_CHANNELS + channel;
+}
+
+bool TerrainFile::has_tile(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const
+{
+	return index[get_slot(level, tx, ty, channel)].offset != 0;
+}
+
+size_t TerrainFile::get_tile_bytes(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const
+{
+	return index[get_slot(level, tx, ty, channel)].size;
+}
+
+tile_codec::Codec TerrainFile::get_tile_codec(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const
+{
+	return (tile_codec::Codec)index[get_slot(level, tx, ty, channel)].codec;
+}
+
+unsigned int TerrainFile::get_tile_error(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const
+{
+	const Slot& slot = index[get_slot(level, tx, ty, channel)];
+	if (slot.offset == 0 || slot.offset + slot.size > file.get_size())
+		return 0;
+	return tile_codec::get_max_error((tile_codec::Codec)slot.codec, file.get_data() + slot.offset, slot.size);
+}
+
+bool TerrainFile::read_tile(unsigned int level, unsigned int tx, unsigned int ty, Channel channel, void* texels) const
+{
+	const Slot& slot = index[get_slot(level, tx, ty, channel)];
+	if (slot.offset == 0 || slot.offset + slot.size > file.get_size())
+		return false;
+	tile_codec::Layout layout = get_layout(channel, get_tile_texels(level, tx, ty));
+	return tile_codec::decode((tile_codec::Codec)slot.codec, layout, file.get_data() + slot.offset, slot.size, texels);
+}
+
+bool TerrainFileWriter::create(const std::string& path, const NoiseSettings& settings, unsigned int width, unsigned int height, unsigned int num_levels, unsigned int tile_size)
+{
+	close();
+	header = {};
+	memcpy(header.magic, FILE_MAGIC, 4);
+	header.version = TerrainFile::VERSION;
+	header.width = width;
+	header.height = height;
+	header.tile_size = tile_size;
+	header.num_levels = num_levels;
+	header.index_offset = sizeof(TerrainFile::Header);
+	header.offset[0] = settings.offset.x;
+	header.offset[1] = settings.offset.y;
+	header.offset[2] = settings.offset.z;
+	header.frequency = settings.frequency;
+	header.octaves = settings.octaves;
+	header.amplitude = settings.amplitude;
+	header.lacunarity = settings.lacunarity;
+	header.gain = settings.gain;
+	header.range = settings.range;
+	header.biome_frequency = settings.biome_frequency;
+	header.biome_octaves = settings.biome_octaves;
+	header.biome_amplitude = settings.biome_amplitude;
+	header.biome_lacunarity = settings.biome_lacunarity;
+	header.biome_gain = settings.biome_gain;
+	header.biome_range = settings.biome_range;
+	header.band_limit = settings.band_limit;
+	if (!layout.read_header(header))
+		return false;
+	stream.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!stream)
+		return false;
+	slots.assign(layout.get_num_slots(), TerrainFile::Slot());
+	stream.write((const char*)&header, sizeof(header));
+	stream.write((const char*)slots.data(), slots.size() * sizeof(TerrainFile::Slot));
+	end = header.index_offset + slots.size() * sizeof(TerrainFile::Slot);
+	bands.assign(num_levels, Band());
+	rows_written = 0;
+	bytes_written = 0;
+	return (bool)stream;
+}
+
+bool TerrainFileWriter::open(const std::string& path)
+{
+	close();
+	stream.open(path, std::ios::in | std::ios::out | std::ios::binary);
+	if (!stream.read((char*)&header, sizeof(header)) || !layout.read_header(header)) {
+		close();
+		return false;
+	}
+	stream.seekg(0, std::ios::end);
+	end = (uint64_t)stream.tellg();
+	if (!layout.fits_index(header, end)) {
+		close();
+		return false;
+	}
+	slots.resize(layout.get_num_slots());
+	stream.seekg(header.index_offset);
+	if (!stream.read((char*)slots.data(), slots.size() * sizeof(TerrainFile::Slot))) {
+		close();
+		return false;
+	}
+	bands.assign(layout.num_levels, Band());
+	rows_written = 0;
+	bytes_written = 0;
+	return true;
+}
+
+void TerrainFileWriter::close()
+{
+	if (stream.is_open())
+		stream.close();
+	stream.clear();
+	slots.clear();
+	bands.clear();
+}
+
+void TerrainFileWriter::write_slot(size_t slot)
+{
+	stream.seekp(header.index_offset + slot * sizeof(TerrainFile::Slot));
+	stream.write((const char*)&slots[slot], sizeof(TerrainFile::Slot));
+}
+
+bool TerrainFileWriter::write_tile(unsigned int level, unsigned int tx, unsigned int ty, TerrainFile::Channel channel, const void* texels)
+{
+	if (!stream.is_open() || level >= layout.num_levels)
+		return false;
+	glm::uvec2 count = layout.get_tile_count(level);
+	if (tx >= count.x || ty >= count.y)
+		return false;
+	tile_codec::Layout tile_layout = TerrainFile::get_layout(channel, layout.get_tile_texels(level, tx, ty));
+	tile_codec::Codec tile_encoding = codec;
+	unsigned int max_error = 0;
+	if (channel == TerrainFile::HEIGHT)
+		max_error = TerrainFile::get_height_error_steps(height_error * (scale_height_error ? (float)(1u << level) : 1.0f), height_scale);
+	if (max_error > 0)
+		tile_encoding = tile_codec::MED_LOSSY;
+	encoded.clear();
+	tile_codec::encode(tile_encoding, tile_layout, texels, encoded, max_error);
+	if (tile_encoding != tile_codec::RAW && encoded.size() >= tile_layout.get_size()) {
+		tile_encoding = tile_codec::RAW;
+		encoded.assign((const uint8_t*)texels, (const uint8_t*)texels + tile_layout.get_size());
+	}
+
+	TerrainFile::Slot& slot = slots[layout.get_slot(level, tx, ty, channel)];
+	if (slot.offset == 0 || encoded.size() > slot.capacity) {
+		slot.offset = end;
+		slot.capacity = (uint32_t)encoded.size();
+		end += encoded.size();
+	}
+	slot.size = (uint32_t)encoded.size();
+	slot.codec = tile_encoding;
+	stream.seekp(slot.offset);
+	stream.write((const char*)encoded.data(), encoded.size());
+	write_slot(layout.get_slot(level, tx, ty, channel));
+	bytes_written += encoded.size();
+	return (bool)stream;
+}
+
+bool TerrainFileWriter::write_rows(const uint16_t* height, const uint8_t* biome, const uint16_t* slope, unsigned int rows)
+{
+	unsigned int map_width = layout.width;
+	if (!stream.is_open() || rows == 0 || rows_written + rows > layout.height
+		|| (rows != layout.tile_size && rows_written + rows != layout.height))
+		return false;
+	Band& band = bands[0];
+	const void* channels[TerrainFile::NUM_CHANNELS] = { height, biome, slope };
+	for (unsigned int c = 0; c < TerrainFile::NUM_CHANNELS; c++)
+		band.texels[c].assign((const uint8_t*)channels[c], (const uint8_t*)channels[c] + (size_t)map_width * rows * TEXEL_BYTES[c]);
+	band.rows = rows;
+	rows_written += rows;
+	return flush_band(0);
+}
+
+bool TerrainFileWriter::flush_band(unsigned int level)
+{
+	Band& band = bands[level];
+	glm::uvec2 size = layout.get_level_size(level);
+	unsigned int tile_size = layout.tile_size;
+	std::vector<uint8_t> tile;
+	bool ok = true;
+	for (unsigned int tx = 0; tx * tile_size < size.x; tx++)
+		for (unsigned int c = 0; c < TerrainFile::NUM_CHANNELS; c++) {
+			unsigned int texel_bytes = TEXEL_BYTES[c];
+			unsigned int tile_width = std::min(tile_size, size.x - tx * tile_size);
+			tile.resize((size_t)tile_width * band.rows * texel_bytes);
+			for (unsigned int y = 0; y < band.rows; y++)
+				memcpy(&tile[(size_t)y * tile_width * texel_bytes], &band.texels[c][((size_t)y * size.x + tx * tile_size) * texel_bytes], (size_t)tile_width * texel_bytes);
+			ok &= write_tile(level, tx, band.tile_row, (TerrainFile::Channel)c, tile.data());
+		}
+
+	if (level + 1 < layout.num_levels) {
+		// 2x2 box filter, the last column and row of an odd size averaged with themselves
+		Band& next = bands[level + 1];
+		glm::uvec2 next_size = layout.get_level_size(level + 1);
+		unsigned int rows = (band.rows + 1) / 2;
+		for (unsigned int c = 0; c < TerrainFile::NUM_CHANNELS; c++)
+			next.texels[c].resize((size_t)next_size.x * (next.rows + rows) * TEXEL_BYTES[c]);
+		for (unsigned int y = 0; y < rows; y++)
+			for (unsigned int x = 0; x < next_size.x; x++) {
+				size_t source[4];
+				unsigned int x0 = 2 * x, x1 = std::min(2 * x + 1, size.x - 1);
+				unsigned int y0 = 2 * y, y1 = std::min(2 * y + 1, band.rows - 1);
+				source[0] = (size_t)y0 * size.x + x0;
+				source[1] = (size_t)y0 * size.x + x1;
+				source[2] = (size_t)y1 * size.x + x0;
+				source[3] = (size_t)y1 * size.x + x1;
+				size_t target = (size_t)(next.rows + y) * next_size.x + x;
+				const uint16_t* height = (const uint16_t*)band.texels[TerrainFile::HEIGHT].data();
+				((uint16_t*)next.texels[TerrainFile::HEIGHT].data())[target] = (uint16_t)((height[source[0]] + height[source[1]] + height[source[2]] + height[source[3]] + 2) / 4);
+				const uint8_t* biome = band.texels[TerrainFile::BIOME].data();
+				for (unsigned int i = 0; i < 2; i++)
+					next.texels[TerrainFile::BIOME][target * 2 + i] = (uint8_t)((biome[source[0] * 2 + i] + biome[source[1] * 2 + i] + biome[source[2] * 2 + i] + biome[source[3] * 2 + i] + 2) / 4);
+				// per texel of the level, which spans twice the distance
+				const uint16_t* slope = (const uint16_t*)band.texels[TerrainFile::SLOPE].data();
+				for (unsigned int i = 0; i < 2; i++) {
+					float sum = 0.0f;
+					for (size_t s : source)
+						sum += glm::unpackHalf1x16(slope[s * 2 + i]);
+					((uint16_t*)next.texels[TerrainFile::SLOPE].data())[target * 2 + i] = glm::packHalf1x16(sum * 0.5f);
+				}
+			}
+		next.rows += rows;
+		if (next.rows == tile_size || next.tile_row * tile_size + next.rows == next_size.y)
+			ok &= flush_band(level + 1);
+	}
+	band.rows = 0;
+	band.tile_row++;
+	return ok;
+}
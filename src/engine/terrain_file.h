@@ -0,0 +1,180 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "noise_settings.h"
+#include "mapped_file.h"
+#include "tile_codec.h"
+
+// Tiled container of a terrain's data on disk, for maps larger than memory that are read a region at a time.
+// The data is stored in the layout of Terrain::PACKED, split into square tiles of tile_size texels (smaller at the far
+// edges) per channel and optionally per mip level, every tile of every channel compressed on its own. The file is:
+//   header		magic, version, map size, tile size, levels and the noise settings it was generated with
+//   index		a Slot per (level, tile row, tile column, channel) in that order, at a fixed place after the header
+//   tile data	the compressed tiles, in the order they were written
+// so a tile is found with one lookup in the index and read with one seek. A tile can be written again at any time: in
+// its slot when it fits, appended otherwise (leaving the old bytes unused), with its index slot rewritten in place.
+// Level l is the map downsampled by 2^l with a box filter, ceil(size / 2^l) texels per side.
+// Height tiles may be stored lossy, within an error bound the tile records (TerrainFileWriter::height_error).
+class TerrainFile {
+public:
+	enum Channel {
+		HEIGHT,		// 16 bit UNORM
+		BIOME,		// moisture and detail, 2 x 8 bit UNORM
+		SLOPE,		// dh/dx, dh/dy per texel of the level, 2 x half float
+		NUM_CHANNELS
+	};
+	static const uint32_t VERSION = 1;
+	static const unsigned int DEFAULT_TILE_SIZE = 256;
+	// largest map side and tile side, so the level sizes, the slot count and the bytes of a tile can't overflow
+	static const unsigned int MAX_SIZE = 1u << 30;
+	static const unsigned int MAX_TILE_SIZE = 1u << 12;
+
+	// layout of the texels of a channel, as uploaded: 1 x GL_UNSIGNED_SHORT, 2 x GL_UNSIGNED_BYTE, 2 x GL_HALF_FLOAT
+	static tile_codec::Layout get_layout(Channel channel, glm::uvec2 size);
+	// largest height error of a world space error at height_scale, in 16 bit UNORM steps
+	static unsigned int get_height_error_steps(float world_error, float height_scale);
+
+	TerrainFile() {}
+	TerrainFile(const TerrainFile&) = delete;
+	TerrainFile& operator=(const TerrainFile&) = delete;
+
+	// maps the file for reading, false if it isn't a terrain file
+	bool open(const std::string& path);
+	void close();
+	bool is_open() const { return file.is_open(); }
+
+	const NoiseSettings& get_settings() const { return settings; }
+	unsigned int get_width() const { return width; }
+	unsigned int get_height() const { return height; }
+	unsigned int get_tile_size() const { return tile_size; }
+	unsigned int get_num_levels() const { return num_levels; }
+	glm::uvec2 get_level_size(unsigned int level) const;
+	glm::uvec2 get_tile_count(unsigned int level) const;
+	// texels of the tile, tile_size but at the far edges
+	glm::uvec2 get_tile_texels(unsigned int level, unsigned int tx, unsigned int ty) const;
+
+	// whether the tile of the channel has been written
+	bool has_tile(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const;
+	// decodes the tile of the channel into texels (get_layout() of its size), false if it is missing or damaged
+	bool read_tile(unsigned int level, unsigned int tx, unsigned int ty, Channel channel, void* texels) const;
+	// bytes the tile takes in the file
+	size_t get_tile_bytes(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const;
+	tile_codec::Codec get_tile_codec(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const;
+	// largest difference between a sample of the tile as read and the one written, 0 for a lossless tile
+	unsigned int get_tile_error(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const;
+
+private:
+	friend class TerrainFileWriter;
+
+	// the on-disk header and index entries, little endian
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t tile_size;
+		uint32_t num_levels;
+		uint64_t index_offset;
+		uint64_t reserved;
+		float offset[3];
+		float frequency;
+		int32_t octaves;
+		float amplitude;
+		float lacunarity;
+		float gain;
+		float range;
+		float biome_frequency;
+		int32_t biome_octaves;
+		float biome_amplitude;
+		float biome_lacunarity;
+		float biome_gain;
+		float biome_range;
+		uint32_t band_limit;
+	};
+	struct Slot {
+		// 0 for a tile not written yet
+		uint64_t offset;
+		uint32_t size;
+		// bytes reserved for the tile, a rewrite up to this size stays in place
+		uint32_t capacity;
+		uint32_t codec;
+		uint32_t reserved;
+	};
+
+	MappedFile file;
+	NoiseSettings settings = NoiseSettings::defaults();
+	unsigned int width = 0, height = 0, tile_size = 0, num_levels = 0;
+	const Slot* index = nullptr;
+	// first slot of every level
+	std::vector<size_t> level_slots;
+
+	// sets the sizes and level_slots from the header, false if they are invalid
+	bool read_header(const Header& header);
+	// whether the index of the header fits in a file of file_size bytes, after read_header()
+	bool fits_index(const Header& header, uint64_t file_size) const;
+	size_t get_slot(unsigned int level, unsigned int tx, unsigned int ty, Channel channel) const;
+	size_t get_num_slots() const { return level_slots.back(); }
+};
+
+// Writes a TerrainFile, either a new one tile by tile as the generator produces the map, or tiles of an existing one.
+class TerrainFileWriter {
+public:
+	// codec the tiles are compressed with; one that doesn't beat RAW on a tile falls back to it
+	tile_codec::Codec codec = tile_codec::MED;
+	// Largest height error of the height tiles in world units at height_scale, above 0 to store them with MED_LOSSY; by
+	// default every level keeps to it. The mip levels are built from the exact heights, the errors of one level don't
+	// carry into the next.
+	float height_error = 0.0f;
+	float height_scale = 128.0f;
+	// Opts in to height_error * 2^l for level l instead: its texels are 2^l times as far apart, and a renderer picks it
+	// for ground about that much further away, so the error stays about the same on screen whatever level is drawn.
+	bool scale_height_error = false;
+
+	TerrainFileWriter() {}
+	~TerrainFileWriter() { close(); }
+	TerrainFileWriter(const TerrainFileWriter&) = delete;
+	TerrainFileWriter& operator=(const TerrainFileWriter&) = delete;
+
+	// creates the file with every tile missing; tile_size is even
+	bool create(const std::string& path, const NoiseSettings& settings, unsigned int width, unsigned int height, unsigned int num_levels = 1, unsigned int tile_size = TerrainFile::DEFAULT_TILE_SIZE);
+	// opens an existing file for rewriting tiles
+	bool open(const std::string& path);
+	void close();
+
+	// writes the tile of the channel from texels (TerrainFile::get_layout() of its size), false on an I/O error
+	bool write_tile(unsigned int level, unsigned int tx, unsigned int ty, TerrainFile::Channel channel, const void* texels);
+
+	// Streams a new map in: the next band of rows of level 0, tile_size of them but for the last one, as rows x width
+	// texels of every channel. Their tiles are written at once and the mip levels built from them band by band, so only
+	// about a band per level is held in memory.
+	bool write_rows(const uint16_t* height, const uint8_t* biome, const uint16_t* slope, unsigned int rows);
+	// level 0 rows written so far
+	unsigned int get_rows_written() const { return rows_written; }
+	// bytes of tile data written since the file was created or opened
+	uint64_t get_bytes_written() const { return bytes_written; }
+
+private:
+	// rows of a level not written to tiles yet, starting at its current tile row
+	struct Band {
+		std::vector<uint8_t> texels[TerrainFile::NUM_CHANNELS];
+		unsigned int rows = 0;
+		unsigned int tile_row = 0;
+	};
+
+	std::fstream stream;
+	TerrainFile::Header header;
+	TerrainFile layout;
+	std::vector<TerrainFile::Slot> slots;
+	uint64_t end = 0;
+	std::vector<Band> bands;
+	unsigned int rows_written = 0;
+	uint64_t bytes_written = 0;
+	std::vector<uint8_t> encoded;
+
+	void write_slot(size_t slot);
+	// writes the complete band of the level as tiles and adds its downsampled rows to the next level's
+	bool flush_band(unsigned int level);
+};
@@ -0,0 +1,116 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int i = 0; i <= num_threads; i++)
+		queues.emplace_back(new Queue());
+	for (unsigned int i = 0; i < num_threads; i++)
+		threads.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void ThreadPool::push(unsigned int queue, std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+		queues[queue]->tasks.push_back(std::move(task));
+	}
+	{
+		// increment under the sleep mutex so a worker can't miss the wake up between its check and its wait
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		pending++;
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	push(next_queue++ % get_num_threads(), std::move(task));
+}
+
+bool ThreadPool::try_run(unsigned int queue)
+{
+	std::function<void()> task;
+	unsigned int num_queues = (unsigned int)queues.size();
+	for (unsigned int i = 0; i < num_queues && !task; i++) {
+		Queue& q = *queues[(queue + i) % num_queues];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.tasks.empty())
+			continue;
+		// own queue: newest task (still hot in cache), other queues: steal the oldest one
+		if (i == 0) {
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		}
+		else {
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		}
+	}
+	if (!task)
+		return false;
+	pending--;
+	task();
+	return true;
+}
+
+void ThreadPool::worker_loop(unsigned int index)
+{
+	while (true) {
+		if (try_run(index))
+			continue;
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [this] { return stop || pending > 0; });
+		if (stop)
+			return;
+	}
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& task)
+{
+	if (count == 0)
+		return;
+	// shared with the tasks, so the last one to finish never touches state the caller already released
+	struct Batch {
+		std::atomic<size_t> remaining;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	auto batch = std::make_shared<Batch>();
+	batch->remaining = count;
+
+	// contiguous blocks per worker, the caller's own queue gets a share as well
+	unsigned int num_queues = (unsigned int)queues.size();
+	for (size_t i = 0; i < count; i++) {
+		unsigned int queue = (unsigned int)(i * num_queues / count);
+		push(queue, [batch, &task, i] {
+			task(i);
+			if (--batch->remaining == 0) {
+				std::lock_guard<std::mutex> lock(batch->mutex);
+				batch->done.notify_all();
+			}
+		});
+	}
+
+	unsigned int own = num_queues - 1;
+	while (batch->remaining > 0) {
+		if (try_run(own))
+			continue;
+		// everything left is already running on the workers
+		std::unique_lock<std::mutex> lock(batch->mutex);
+		batch->done.wait(lock, [&batch] { return batch->remaining == 0; });
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+// Work-stealing thread pool.
+// Every worker owns a task deque: it pops its own tasks from the back and, once empty, steals from the front of the
+// other workers' deques. parallel_for() hands each worker a contiguous block of the index range, so neighbouring tasks
+// (e.g. neighbouring terrain tiles) stay on one core unless the load gets unbalanced.
+class ThreadPool {
+public:
+	// num_threads = 0 uses one worker per hardware thread
+	explicit ThreadPool(unsigned int num_threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned int get_num_threads() const { return (unsigned int)threads.size(); }
+
+	// queues a task to run asynchronously on any worker
+	void submit(std::function<void()> task);
+	// runs task(i) for every i in [0, count) and returns once all of them finished; the calling thread helps out
+	void parallel_for(size_t count, const std::function<void(size_t)>& task);
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::thread> threads;
+	// one queue per worker, plus a last one for tasks pushed by parallel_for's calling thread
+	std::vector<std::unique_ptr<Queue>> queues;
+
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	std::atomic<size_t> pending{ 0 };
+	std::atomic<unsigned int> next_queue{ 0 };
+	bool stop = false;
+
+	void push(unsigned int queue, std::function<void()> task);
+	// pops from the given queue, or steals from another one; returns false if every queue is empty
+	bool try_run(unsigned int queue);
+	void worker_loop(unsigned int index);
+};
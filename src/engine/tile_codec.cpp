@@ -0,0 +1,326 @@
+#include "tile_codec.h"
+#include <algorithm>
+#include <cstring>
+#include "noise_generator.h"
+
+#ifdef TILE_CODEC_X86
+// SSE4.1 MED decoder, compiled in its own translation unit with the instruction set enabled
+bool decode_med_sse41(const tile_codec::Layout& layout, const uint8_t* data, size_t size, unsigned int max_error, void* texels);
+#endif
+
+namespace {
+	// component c of texel i
+	unsigned int get_sample(const tile_codec::Layout& layout, const void* texels, size_t i, unsigned int c)
+	{
+		size_t index = i * layout.components + c;
+		if (layout.component_bytes == 1)
+			return ((const uint8_t*)texels)[index];
+		return ((const uint16_t*)texels)[index];
+	}
+
+	void set_sample(const tile_codec::Layout& layout, void* texels, size_t i, unsigned int c, unsigned int value)
+	{
+		size_t index = i * layout.components + c;
+		if (layout.component_bytes == 1)
+			((uint8_t*)texels)[index] = (uint8_t)value;
+		else
+			((uint16_t*)texels)[index] = (uint16_t)value;
+	}
+
+	// residuals wrap around at the sample width, so the one of any two samples fits in it
+	unsigned int zigzag(unsigned int residual, unsigned int bits)
+	{
+		int value = (int)(residual << (32 - bits)) >> (32 - bits);
+		return (unsigned int)((value << 1) ^ (value >> 31)) & ((1u << bits) - 1);
+	}
+
+	unsigned int unzigzag(unsigned int value)
+	{
+		return (value >> 1) ^ (0u - (value & 1));
+	}
+
+	void encode_delta(const tile_codec::Layout& layout, const void* texels, std::vector<uint8_t>& out)
+	{
+		unsigned int bits = layout.component_bytes * 8;
+		unsigned int mask = (1u << bits) - 1;
+		for (unsigned int c = 0; c < layout.components; c++)
+			for (unsigned int y = 0; y < layout.height; y++)
+				for (unsigned int x = 0; x < layout.width; x++) {
+					size_t i = (size_t)y * layout.width + x;
+					unsigned int prediction = x > 0 ? get_sample(layout, texels, i - 1, c) : (y > 0 ? get_sample(layout, texels, i - layout.width, c) : 0);
+					unsigned int value = zigzag((get_sample(layout, texels, i, c) - prediction) & mask, bits);
+					while (value >= 0x80) {
+						out.push_back((uint8_t)(value | 0x80));
+						value >>= 7;
+					}
+					out.push_back((uint8_t)value);
+				}
+	}
+
+	bool decode_delta(const tile_codec::Layout& layout, const uint8_t* data, size_t size, void* texels)
+	{
+		unsigned int mask = (1u << (layout.component_bytes * 8)) - 1;
+		const uint8_t* end = data + size;
+		for (unsigned int c = 0; c < layout.components; c++)
+			for (unsigned int y = 0; y < layout.height; y++)
+				for (unsigned int x = 0; x < layout.width; x++) {
+					unsigned int value = 0;
+					for (unsigned int shift = 0;; shift += 7) {
+						if (data == end || shift > 14)
+							return false;
+						value |= (unsigned int)(*data & 0x7f) << shift;
+						if (!(*data++ & 0x80))
+							break;
+					}
+					size_t i = (size_t)y * layout.width + x;
+					unsigned int prediction = x > 0 ? get_sample(layout, texels, i - 1, c) : (y > 0 ? get_sample(layout, texels, i - layout.width, c) : 0);
+					set_sample(layout, texels, i, c, (prediction + unzigzag(value)) & mask);
+				}
+		return data == end;
+	}
+
+	unsigned int med(unsigned int a, unsigned int b, unsigned int c)
+	{
+		unsigned int low = std::min(a, b), high = std::max(a, b);
+		if (c >= high)
+			return low;
+		if (c <= low)
+			return high;
+		return a + b - c;
+	}
+
+	unsigned int bit_width(unsigned int value)
+	{
+		unsigned int bits = 0;
+		for (; value != 0; value >>= 1)
+			bits++;
+		return bits;
+	}
+
+	// prediction of column i of strip k (at = i * MED_STRIPS + k) from the decoded rows y and y - 1 of a plane
+	unsigned int med_prediction(const uint16_t* current, const uint16_t* previous, unsigned int y, unsigned int i, size_t at)
+	{
+		using tile_codec::MED_STRIPS;
+		if (y == 0)
+			return i == 0 ? 0 : current[at - MED_STRIPS];
+		return i == 0 ? previous[at] : med(current[at - MED_STRIPS], previous[at], previous[at - MED_STRIPS]);
+	}
+
+	// the decoded sample of a quantised residual q of MED_LOSSY
+	unsigned int dequantise(unsigned int prediction, int q, unsigned int step, unsigned int mask)
+	{
+		long long value = (long long)prediction + (long long)q * step;
+		return (unsigned int)std::min<long long>(std::max<long long>(value, 0), mask);
+	}
+
+	void encode_med(const tile_codec::Layout& layout, const void* texels, unsigned int max_error, std::vector<uint8_t>& out)
+	{
+		using namespace tile_codec;
+		unsigned int bits = layout.component_bytes * 8;
+		unsigned int mask = (1u << bits) - 1;
+		unsigned int step = 2 * max_error + 1;
+		unsigned int strip = med_strip_width(layout.width);
+		size_t row_size = (size_t)strip * MED_STRIPS;
+		// the last two rows of every plane as the decoder sees them, in group order
+		std::vector<uint16_t> rows(2 * layout.components * row_size);
+		std::vector<unsigned int> residuals;
+		residuals.reserve((size_t)layout.height * layout.components * row_size);
+		for (unsigned int y = 0; y < layout.height; y++)
+			for (unsigned int c = 0; c < layout.components; c++) {
+				uint16_t* current = &rows[(c * 2 + (y & 1)) * row_size];
+				const uint16_t* previous = &rows[(c * 2 + (~y & 1)) * row_size];
+				for (unsigned int i = 0; i < strip; i++)
+					for (unsigned int k = 0; k < MED_STRIPS; k++) {
+						unsigned int x = std::min(k * strip + i, layout.width - 1);
+						unsigned int sample = get_sample(layout, texels, (size_t)y * layout.width + x, c);
+						size_t at = i * MED_STRIPS + k;
+						unsigned int prediction = med_prediction(current, previous, y, i, at);
+						if (max_error == 0) {
+							residuals.push_back(zigzag((sample - prediction) & mask, bits));
+							current[at] = (uint16_t)sample;
+							continue;
+						}
+						int difference = (int)sample - (int)prediction;
+						int q = difference >= 0 ? (int)((difference + max_error) / step) : -(int)((max_error - difference) / step);
+						// |q| < 2^(bits - 1) for any max_error > 0, so it zigzags into the sample width
+						residuals.push_back(((unsigned int)q << 1) ^ (unsigned int)(q >> 31));
+						current[at] = (uint16_t)dequantise(prediction, q, step, mask);
+					}
+			}
+
+		size_t groups = residuals.size() / MED_STRIPS;
+		for (size_t block = 0; block < groups; block += MED_BLOCK_GROUPS) {
+			size_t block_end = std::min(groups, block + MED_BLOCK_GROUPS);
+			unsigned int widest = 0;
+			for (size_t r = block * MED_STRIPS; r < block_end * MED_STRIPS; r++)
+				widest |= residuals[r];
+			unsigned int width = bit_width(widest);
+			out.push_back((uint8_t)width);
+			for (size_t group = block; group < block_end; group++) {
+				size_t first = out.size();
+				out.resize(first + width, 0);
+				for (unsigned int j = 0; j < MED_STRIPS; j++) {
+					unsigned int bit = j * width;
+					for (unsigned int value = residuals[group * MED_STRIPS + j] << (bit & 7), byte = bit / 8; value != 0; value >>= 8, byte++)
+						out[first + byte] |= (uint8_t)value;
+				}
+			}
+		}
+		out.insert(out.end(), MED_PADDING, 0);
+	}
+
+	bool decode_med(const tile_codec::Layout& layout, const uint8_t* data, size_t size, unsigned int max_error, void* texels)
+	{
+		using namespace tile_codec;
+		unsigned int bits = layout.component_bytes * 8;
+		unsigned int mask = (1u << bits) - 1;
+		unsigned int step = 2 * max_error + 1;
+		unsigned int strip = med_strip_width(layout.width);
+		size_t row_size = (size_t)strip * MED_STRIPS;
+		// the last two rows of every plane in group order, column i of strip k at i * MED_STRIPS + k
+		std::vector<uint16_t> rows(2 * layout.components * row_size);
+		if (size < MED_PADDING)
+			return false;
+		const uint8_t* end = data + size - MED_PADDING;
+		unsigned int width = 0;
+		size_t group = 0;
+		for (unsigned int y = 0; y < layout.height; y++)
+			for (unsigned int c = 0; c < layout.components; c++) {
+				uint16_t* current = &rows[(c * 2 + (y & 1)) * row_size];
+				const uint16_t* previous = &rows[(c * 2 + (~y & 1)) * row_size];
+				for (unsigned int i = 0; i < strip; i++, group++) {
+					if (group % MED_BLOCK_GROUPS == 0) {
+						if (data == end || *data > bits)
+							return false;
+						width = *data++;
+					}
+					if ((size_t)(end - data) < width)
+						return false;
+					for (unsigned int k = 0; k < MED_STRIPS; k++) {
+						// the padding keeps the 4 bytes in the buffer
+						unsigned int bit = k * width;
+						uint32_t word;
+						memcpy(&word, data + bit / 8, 4);
+						unsigned int residual = (word >> (bit & 7)) & ((1u << width) - 1);
+						size_t at = i * MED_STRIPS + k;
+						unsigned int prediction = med_prediction(current, previous, y, i, at);
+						if (max_error == 0)
+							current[at] = (uint16_t)((prediction + unzigzag(residual)) & mask);
+						else
+							current[at] = (uint16_t)dequantise(prediction, (int)unzigzag(residual), step, mask);
+					}
+					data += width;
+				}
+				for (unsigned int k = 0; k < MED_STRIPS; k++)
+					for (unsigned int i = 0; i < strip && k * strip + i < layout.width; i++)
+						set_sample(layout, texels, (size_t)y * layout.width + k * strip + i, c, current[i * MED_STRIPS + k]);
+			}
+		return data == end;
+	}
+
+	bool decode_med(const tile_codec::Layout& layout, const uint8_t* data, size_t size, unsigned int max_error, void* texels, bool simd)
+	{
+#ifdef TILE_CODEC_X86
+		if (simd && tile_codec::has_simd())
+			return decode_med_sse41(layout, data, size, max_error, texels);
+#endif
+		return decode_med(layout, data, size, max_error, texels);
+	}
+
+	unsigned int read_max_error(const uint8_t* data)
+	{
+		return data[0] | (unsigned int)data[1] << 8;
+	}
+
+	void encode_med_lossy(const tile_codec::Layout& layout, const void* texels, unsigned int max_error, std::vector<uint8_t>& out)
+	{
+		unsigned int mask = (1u << (layout.component_bytes * 8)) - 1;
+		max_error = std::min(max_error, mask);
+		size_t first = out.size();
+		out.push_back((uint8_t)max_error);
+		out.push_back((uint8_t)(max_error >> 8));
+		encode_med(layout, texels, max_error, out);
+		if (max_error == 0)
+			return;
+		// the bound is checked on the tile as decode() returns it rather than trusted, and kept exactly with MED otherwise
+		std::vector<uint8_t> decoded(layout.get_size());
+		bool bounded = decode_med(layout, &out[first + 2], out.size() - first - 2, max_error, decoded.data(), true);
+		size_t samples = (size_t)layout.width * layout.height * layout.components;
+		for (size_t i = 0; i < samples && bounded; i++) {
+			unsigned int sample = get_sample(layout, texels, i / layout.components, i % layout.components);
+			unsigned int value = get_sample(layout, decoded.data(), i / layout.components, i % layout.components);
+			bounded = (sample > value ? sample - value : value - sample) <= max_error;
+		}
+		if (!bounded) {
+			out.resize(first);
+			out.insert(out.end(), 2, 0);
+			encode_med(layout, texels, 0, out);
+		}
+	}
+}
+
+namespace tile_codec {
+	void encode(Codec codec, const Layout& layout, const void* texels, std::vector<uint8_t>& out, unsigned int max_error)
+	{
+		switch (codec) {
+		case DELTA:
+			encode_delta(layout, texels, out);
+			break;
+		case MED:
+			encode_med(layout, texels, 0, out);
+			break;
+		case MED_LOSSY:
+			encode_med_lossy(layout, texels, max_error, out);
+			break;
+		default:
+			out.insert(out.end(), (const uint8_t*)texels, (const uint8_t*)texels + layout.get_size());
+			break;
+		}
+	}
+
+	bool decode(Codec codec, const Layout& layout, const uint8_t* data, size_t size, void* texels, bool simd)
+	{
+		switch (codec) {
+		case RAW:
+			if (size != layout.get_size())
+				return false;
+			memcpy(texels, data, size);
+			return true;
+		case DELTA:
+			return decode_delta(layout, data, size, texels);
+		case MED:
+			return decode_med(layout, data, size, 0, texels, simd);
+		case MED_LOSSY:
+			if (size < 2 || read_max_error(data) >= 1u << (layout.component_bytes * 8))
+				return false;
+			return decode_med(layout, data + 2, size - 2, read_max_error(data), texels, simd);
+		default:
+			return false;
+		}
+	}
+
+	const char* codec_name(Codec codec)
+	{
+		switch (codec) {
+		case DELTA:
+			return "delta";
+		case MED:
+			return "med";
+		case MED_LOSSY:
+			return "med-lossy";
+		default:
+			return "raw";
+		}
+	}
+
+	unsigned int get_max_error(Codec codec, const uint8_t* data, size_t size)
+	{
+		return codec == MED_LOSSY && size >= 2 ? read_max_error(data) : 0;
+	}
+
+	bool has_simd()
+	{
+		static const bool supported = NoiseGenerator::is_supported(NoiseGenerator::SSE41);
+		return supported;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TILE_CODEC_X86 1
+#endif
+
+// Compression of the tiles of a TerrainFile. A tile of a channel is w x h texels of 1 to 4 components of 8 or 16 bit
+// integers (halfs are stored by their bits), interleaved as they are uploaded; every codec works on the component planes
+// one after another, so the interleaving costs nothing in ratio.
+namespace tile_codec {
+	enum Codec {
+		RAW,	// the texels as they are
+		DELTA,	// per plane, the difference to the left texel (the one above in the first column), zigzagged into LEB128 varints
+		MED,	// per plane, the residual of the median edge detector predictor, zigzagged and bit packed (see below)
+		MED_LOSSY	// MED with the residuals quantised to a maximum error per sample (see below)
+	};
+
+	// MED layout: a plane is split into MED_STRIPS vertical strips of the same width, a multiple of 8 (the columns past the
+	// tile repeat its last one), each predicted on its own so a decoder can run them in the lanes of a vector. The texels
+	// are visited row by row, then plane by plane, then column by column within the strips; each step is a group of one
+	// residual per strip, and the groups are packed MED_BLOCK_GROUPS at a time behind a byte giving the bits of the
+	// widest residual of the block, value j of a group at bit j * width of the group's width bytes. MED_PADDING zero
+	// bytes close the tile so the groups can be read a vector at a time.
+	// The prediction is the median edge detector of LOCO-I / JPEG-LS from the left (a), upper (b) and upper-left (c)
+	// texels: min(a, b) if c >= max(a, b), max(a, b) if c <= min(a, b), a + b - c otherwise; b in the first column of a
+	// strip, a in the first row and 0 at the first texel of a strip. Residuals wrap around at the sample width.
+	// MED_LOSSY is the near-lossless mode of JPEG-LS on the same layout: the tile starts with the maximum error e as a
+	// 16 bit integer, and a residual r is stored as q = sign(r) * floor((|r| + e) / (2e + 1)), the texel becoming the
+	// prediction plus q * (2e + 1) clamped to the sample range. The encoder predicts from these decoded texels, so the
+	// error never adds up along a row, and decodes the tile again to check it; with e = 0 it is MED with a header.
+	const unsigned int MED_STRIPS = 8;
+	const unsigned int MED_BLOCK_GROUPS = 4;
+	const unsigned int MED_PADDING = 16;
+	// columns per strip of a tile width wide
+	inline unsigned int med_strip_width(unsigned int width) { return (width + MED_STRIPS * 8 - 1) / (MED_STRIPS * 8) * 8; }
+
+	// layout of the texels of a tile
+	struct Layout {
+		unsigned int width;
+		unsigned int height;
+		unsigned int components;
+		// 1 or 2
+		unsigned int component_bytes;
+
+		size_t get_size() const { return (size_t)width * height * components * component_bytes; }
+	};
+
+	// appends the encoded texels to out; max_error is the largest difference between a sample and its decoded value the
+	// lossy codecs may introduce
+	void encode(Codec codec, const Layout& layout, const void* texels, std::vector<uint8_t>& out, unsigned int max_error = 0);
+	// decodes size bytes of data into texels, false if they are not a tile of this layout; simd picks the SSE4.1 MED
+	// decoder when the CPU has it, the output is the same either way
+	bool decode(Codec codec, const Layout& layout, const uint8_t* data, size_t size, void* texels, bool simd = true);
+	const char* codec_name(Codec codec);
+	// largest difference between a sample of the encoded tile and the one it was encoded from, 0 for a lossless codec
+	unsigned int get_max_error(Codec codec, const uint8_t* data, size_t size);
+	// whether decode() has a SIMD path on this CPU
+	bool has_simd();
+}
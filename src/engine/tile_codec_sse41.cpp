@@ -0,0 +1,209 @@
+#include "tile_codec.h"
+
+// SSE4.1 decoder of tile_codec::MED: the strips of a plane in the 8 lanes of a vector of 16 bit samples, so every
+// instruction of the prediction decodes a whole group.
+// Needs SSE4.1 code generation enabled for this file only (see src/CMakeLists.txt).
+#ifdef TILE_CODEC_X86
+#include <cstring>
+#include <vector>
+#include <smmintrin.h>
+
+namespace {
+	// Per residual width, how a group of 8 values is unpacked: the byte shuffles gathering the 3 bytes each value
+	// overlaps into a 32 bit lane (values 0-3, then 4-7), and the multipliers moving its first bit to bit 8 of the lane.
+	// Plain arrays, so building them runs no SSE4.1 code on CPUs without it.
+	struct UnpackTables {
+		alignas(16) int8_t shuffle[17][2][16];
+		alignas(16) int32_t multiplier[17][2][4];
+
+		UnpackTables()
+		{
+			for (unsigned int width = 0; width <= 16; width++)
+				for (unsigned int j = 0; j < 8; j++) {
+					unsigned int bit = j * width;
+					for (unsigned int b = 0; b < 4; b++) {
+						unsigned int byte = bit / 8 + b;
+						shuffle[width][j / 4][(j % 4) * 4 + b] = b < 3 && byte < 16 ? (int8_t)byte : (int8_t)-128;
+					}
+					multiplier[width][j / 4][j % 4] = 1 << (8 - (bit & 7));
+				}
+		}
+	};
+
+	struct Unpacker {
+		__m128i shuffle[2];
+		__m128i multiplier[2];
+		__m128i mask;
+
+		void select(const UnpackTables& tables, unsigned int width)
+		{
+			for (unsigned int h = 0; h < 2; h++) {
+				shuffle[h] = _mm_load_si128((const __m128i*)tables.shuffle[width][h]);
+				multiplier[h] = _mm_load_si128((const __m128i*)tables.multiplier[width][h]);
+			}
+			mask = _mm_set1_epi32((1 << width) - 1);
+		}
+
+		// the 8 residuals of the group at data, unzigzagged
+		__m128i unpack(const uint8_t* data) const
+		{
+			__m128i bytes = _mm_loadu_si128((const __m128i*)data);
+			__m128i low = _mm_shuffle_epi8(bytes, shuffle[0]);
+			__m128i high = _mm_shuffle_epi8(bytes, shuffle[1]);
+			low = _mm_and_si128(_mm_srli_epi32(_mm_mullo_epi32(low, multiplier[0]), 8), mask);
+			high = _mm_and_si128(_mm_srli_epi32(_mm_mullo_epi32(high, multiplier[1]), 8), mask);
+			__m128i zigzagged = _mm_packus_epi32(low, high);
+			__m128i sign = _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(zigzagged, _mm_set1_epi16(1)));
+			return _mm_xor_si128(_mm_srli_epi16(zigzagged, 1), sign);
+		}
+	};
+
+	// median edge detector on unsigned 16 bit lanes; a + b - c wraps around, but is only picked when it lies between a and b
+	inline __m128i med(__m128i a, __m128i b, __m128i c)
+	{
+		__m128i low = _mm_min_epu16(a, b);
+		__m128i high = _mm_max_epu16(a, b);
+		__m128i gradient = _mm_sub_epi16(_mm_add_epi16(a, b), c);
+		__m128i above = _mm_cmpeq_epi16(_mm_max_epu16(c, high), c);
+		__m128i below = _mm_cmpeq_epi16(_mm_min_epu16(c, low), c);
+		return _mm_blendv_epi8(_mm_blendv_epi8(gradient, high, below), low, above);
+	}
+
+	// prediction + q * step of MED_LOSSY in 32 bit lanes, q being signed, clamped to [0, mask] by the saturating pack
+	inline __m128i dequantise(__m128i prediction, __m128i q, __m128i step, __m128i mask)
+	{
+		__m128i low = _mm_add_epi32(_mm_cvtepu16_epi32(prediction), _mm_mullo_epi32(_mm_cvtepi16_epi32(q), step));
+		__m128i high = _mm_add_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(prediction, 8)), _mm_mullo_epi32(_mm_cvtepi16_epi32(_mm_srli_si128(q, 8)), step));
+		return _mm_min_epu16(_mm_packus_epi32(low, high), mask);
+	}
+
+	// columns i..i+7 of the 8 strips, one vector per column, to 8 runs of columns, one per strip
+	inline void transpose(const uint16_t* groups, uint16_t* row, unsigned int strip)
+	{
+		__m128i columns[8];
+		for (unsigned int i = 0; i < 8; i++)
+			columns[i] = _mm_loadu_si128((const __m128i*)(groups + i * 8));
+		__m128i t0 = _mm_unpacklo_epi16(columns[0], columns[1]);
+		__m128i t1 = _mm_unpackhi_epi16(columns[0], columns[1]);
+		__m128i t2 = _mm_unpacklo_epi16(columns[2], columns[3]);
+		__m128i t3 = _mm_unpackhi_epi16(columns[2], columns[3]);
+		__m128i t4 = _mm_unpacklo_epi16(columns[4], columns[5]);
+		__m128i t5 = _mm_unpackhi_epi16(columns[4], columns[5]);
+		__m128i t6 = _mm_unpacklo_epi16(columns[6], columns[7]);
+		__m128i t7 = _mm_unpackhi_epi16(columns[6], columns[7]);
+		__m128i u0 = _mm_unpacklo_epi32(t0, t2);
+		__m128i u1 = _mm_unpackhi_epi32(t0, t2);
+		__m128i u2 = _mm_unpacklo_epi32(t1, t3);
+		__m128i u3 = _mm_unpackhi_epi32(t1, t3);
+		__m128i u4 = _mm_unpacklo_epi32(t4, t6);
+		__m128i u5 = _mm_unpackhi_epi32(t4, t6);
+		__m128i u6 = _mm_unpacklo_epi32(t5, t7);
+		__m128i u7 = _mm_unpackhi_epi32(t5, t7);
+		_mm_storeu_si128((__m128i*)(row + 0 * strip), _mm_unpacklo_epi64(u0, u4));
+		_mm_storeu_si128((__m128i*)(row + 1 * strip), _mm_unpackhi_epi64(u0, u4));
+		_mm_storeu_si128((__m128i*)(row + 2 * strip), _mm_unpacklo_epi64(u1, u5));
+		_mm_storeu_si128((__m128i*)(row + 3 * strip), _mm_unpackhi_epi64(u1, u5));
+		_mm_storeu_si128((__m128i*)(row + 4 * strip), _mm_unpacklo_epi64(u2, u6));
+		_mm_storeu_si128((__m128i*)(row + 5 * strip), _mm_unpackhi_epi64(u2, u6));
+		_mm_storeu_si128((__m128i*)(row + 6 * strip), _mm_unpacklo_epi64(u3, u7));
+		_mm_storeu_si128((__m128i*)(row + 7 * strip), _mm_unpackhi_epi64(u3, u7));
+	}
+
+	// interleaves the decoded row of every plane into row y of the tile
+	void store_row(const tile_codec::Layout& layout, const uint16_t* planes, size_t plane_size, unsigned int y, void* texels)
+	{
+		unsigned int width = layout.width;
+		unsigned int x = 0;
+		if (layout.component_bytes == 2) {
+			uint16_t* out = (uint16_t*)texels + (size_t)y * width * layout.components;
+			if (layout.components == 1) {
+				memcpy(out, planes, width * sizeof(uint16_t));
+				return;
+			}
+			if (layout.components == 2)
+				for (; x + 8 <= width; x += 8) {
+					__m128i first = _mm_loadu_si128((const __m128i*)(planes + x));
+					__m128i second = _mm_loadu_si128((const __m128i*)(planes + plane_size + x));
+					_mm_storeu_si128((__m128i*)(out + x * 2), _mm_unpacklo_epi16(first, second));
+					_mm_storeu_si128((__m128i*)(out + x * 2 + 8), _mm_unpackhi_epi16(first, second));
+				}
+			for (; x < width; x++)
+				for (unsigned int c = 0; c < layout.components; c++)
+					out[x * layout.components + c] = planes[c * plane_size + x];
+			return;
+		}
+		uint8_t* out = (uint8_t*)texels + (size_t)y * width * layout.components;
+		if (layout.components <= 2)
+			for (; x + 8 <= width; x += 8) {
+				__m128i first = _mm_loadu_si128((const __m128i*)(planes + x));
+				if (layout.components == 1) {
+					_mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(first, first));
+					continue;
+				}
+				__m128i second = _mm_loadu_si128((const __m128i*)(planes + plane_size + x));
+				__m128i bytes = _mm_packus_epi16(first, second);
+				_mm_storeu_si128((__m128i*)(out + x * 2), _mm_unpacklo_epi8(bytes, _mm_srli_si128(bytes, 8)));
+			}
+		for (; x < width; x++)
+			for (unsigned int c = 0; c < layout.components; c++)
+				out[x * layout.components + c] = (uint8_t)planes[c * plane_size + x];
+	}
+}
+
+bool decode_med_sse41(const tile_codec::Layout& layout, const uint8_t* data, size_t size, unsigned int max_error, void* texels)
+{
+	using namespace tile_codec;
+	static const UnpackTables tables;
+	unsigned int bits = layout.component_bytes * 8;
+	__m128i mask = _mm_set1_epi16((short)((1u << bits) - 1));
+	__m128i step = _mm_set1_epi32((int)(2 * max_error + 1));
+	unsigned int strip = med_strip_width(layout.width);
+	size_t plane_size = (size_t)strip * MED_STRIPS;
+	// the last two rows of every plane as groups, and the current row of every plane as columns
+	std::vector<uint16_t> groups(2 * layout.components * plane_size);
+	std::vector<uint16_t> planes(layout.components * plane_size);
+	if (size < MED_PADDING)
+		return false;
+	const uint8_t* end = data + size - MED_PADDING;
+	Unpacker unpacker;
+	unpacker.select(tables, 0);
+	unsigned int width = 0;
+	size_t group = 0;
+	for (unsigned int y = 0; y < layout.height; y++) {
+		for (unsigned int c = 0; c < layout.components; c++) {
+			uint16_t* current = &groups[(c * 2 + (y & 1)) * plane_size];
+			const uint16_t* previous = &groups[(c * 2 + (~y & 1)) * plane_size];
+			__m128i left = _mm_setzero_si128(), upper_left = _mm_setzero_si128();
+			for (unsigned int i = 0; i < strip; i++, group++) {
+				if (group % MED_BLOCK_GROUPS == 0) {
+					if (data == end || *data > bits)
+						return false;
+					width = *data++;
+					unpacker.select(tables, width);
+				}
+				if ((size_t)(end - data) < width)
+					return false;
+				__m128i residual = unpacker.unpack(data);
+				data += width;
+				__m128i prediction;
+				if (y == 0)
+					prediction = left;
+				else {
+					__m128i up = _mm_loadu_si128((const __m128i*)(previous + i * 8));
+					prediction = i == 0 ? up : med(left, up, upper_left);
+					upper_left = up;
+				}
+				if (max_error == 0)
+					left = _mm_and_si128(_mm_add_epi16(prediction, residual), mask);
+				else
+					left = dequantise(prediction, residual, step, mask);
+				_mm_storeu_si128((__m128i*)(current + i * 8), left);
+			}
+			for (unsigned int i = 0; i < strip; i += 8)
+				transpose(current + i * 8, &planes[c * plane_size + i], strip);
+		}
+		store_row(layout, planes.data(), plane_size, y, texels);
+	}
+	return data == end;
+}
+#endif
@@ -0,0 +1,364 @@
+#include "tile_streamer.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+#include "../utils/frustum.h"
+
+TileStreamer::TileStreamer(Shader* shader, NoiseSettings noise_settings, size_t memory_budget, unsigned int num_threads)
+	: shader(shader), noise_settings(noise_settings)
+{
+	GLint max_layers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	capacity = (unsigned int)std::min<size_t>(std::max<size_t>(memory_budget / LAYER_SIZE, 1), (size_t)std::max(max_layers, 1));
+	for (int layer = capacity - 1; layer >= 0; layer--)
+		free_layers.push_back(layer);
+
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &height_tex);
+	glTextureStorage3D(height_tex, 1, GL_R16, TILE_SAMPLES, TILE_SAMPLES, capacity);
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &biome_tex);
+	glTextureStorage3D(biome_tex, 1, GL_RG8, TILE_SAMPLES, TILE_SAMPLES, capacity);
+	for (GLuint tex : { height_tex, biome_tex }) {
+		glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTextureParameteri(tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	gen_mesh();
+
+	if (num_threads == 0)
+		num_threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+	pool.reset(new ThreadPool(num_threads));
+	// enough to keep every worker busy without queueing tiles the camera will have left by the time they run
+	max_jobs = 2 * pool->get_num_threads();
+	std::cout << "TileStreamer: " << capacity << " tiles of " << TILE_SIZE << "^2 quads, " << get_data_size() / 1024 << " KiB, "
+		<< pool->get_num_threads() << " workers (" << generator.get_backend_name() << ")" << std::endl;
+}
+
+TileStreamer::~TileStreamer()
+{
+	pool.reset();
+	shader = nullptr;
+	glDeleteTextures(1, &height_tex);
+	glDeleteTextures(1, &biome_tex);
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+	glDeleteBuffers(1, &instance_buffer);
+}
+
+glm::ivec2 TileStreamer::tile_at(const glm::vec3& position)
+{
+	return glm::ivec2(glm::floor(glm::vec2(position.x, position.z) / (float)TILE_SIZE));
+}
+
+bool TileStreamer::in_ring(glm::ivec2 coords, int margin) const
+{
+	glm::ivec2 d = glm::abs(coords - center);
+	return std::max(d.x, d.y) <= ring_radius + margin;
+}
+
+void TileStreamer::update(const glm::mat4& view_projection, const glm::vec3& eye, const glm::vec3& forward)
+{
+	center = tile_at(eye);
+	if (ring_offsets_radius != ring_radius) {
+		ring_offsets.clear();
+		for (int x = -ring_radius; x <= ring_radius; x++)
+			for (int z = -ring_radius; z <= ring_radius; z++)
+				ring_offsets.emplace_back(x, z);
+		std::stable_sort(ring_offsets.begin(), ring_offsets.end(), [](glm::ivec2 a, glm::ivec2 b) { return a.x * a.x + a.y * a.y < b.x * b.x + b.y * b.y; });
+		ring_offsets_radius = ring_radius;
+	}
+	predict(eye, forward);
+
+	// the ring is in use this frame and the predicted tiles are about to be, so neither is what gets evicted
+	for (auto it = predicted.rbegin(); it != predicted.rend(); ++it) {
+		auto tile = resident.find(key(*it));
+		if (tile != resident.end())
+			lru.splice(lru.begin(), lru, tile->second.lru_entry);
+	}
+	for (auto it = ring_offsets.rbegin(); it != ring_offsets.rend(); ++it) {
+		auto tile = resident.find(key(center + *it));
+		if (tile != resident.end())
+			lru.splice(lru.begin(), lru, tile->second.lru_entry);
+	}
+
+	// the first frame a prefetched tile is needed tells whether it made it in time
+	for (const glm::ivec2& offset : ring_offsets) {
+		uint64_t k = key(center + offset);
+		auto tile = resident.find(k);
+		if (tile != resident.end()) {
+			if (!tile->second.used && tile->second.prefetched)
+				prefetch_hits++;
+			tile->second.used = true;
+			continue;
+		}
+		auto request = pending.find(k);
+		if (request != pending.end()) {
+			if (!request->second.used && request->second.prefetched)
+				prefetch_late++;
+			request->second.used = true;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(finished_mutex);
+		for (auto& data : finished)
+			staged.push_back(std::move(data));
+		finished.clear();
+	}
+	// a tile one step outside the ring is likely back soon and a predicted one about to be needed, anything else is
+	// thrown away
+	staged.erase(std::remove_if(staged.begin(), staged.end(), [this](const TileData& data) {
+		uint64_t k = key(data.coords);
+		if (in_ring(data.coords, 1) || predicted_order.count(k))
+			return false;
+		if (pending[k].prefetched && !pending[k].used)
+			wasted_prefetches++;
+		pending.erase(k);
+		dropped_tiles++;
+		return true;
+	}), staged.end());
+	// ring tiles nearest first, then the predicted ones in the order the camera should reach them: the staged tiles at
+	// the back get uploaded
+	auto priority = [this](glm::ivec2 coords) {
+		glm::ivec2 d = coords - center;
+		if (in_ring(coords))
+			return d.x * d.x + d.y * d.y;
+		auto order = predicted_order.find(key(coords));
+		return order != predicted_order.end() ? (1 << 20) + order->second : 1 << 21;
+	};
+	std::sort(staged.begin(), staged.end(), [&](const TileData& a, const TileData& b) { return priority(a.coords) > priority(b.coords); });
+	uploads = 0;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	while (uploads < upload_budget && !staged.empty()) {
+		int layer = acquire_layer(staged.back().coords);
+		if (layer < 0)
+			break;
+		upload(staged.back(), layer);
+		staged.pop_back();
+		uploads++;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	unsigned int in_flight = (unsigned int)(pending.size() - staged.size());
+	bool ring_requested = true;
+	for (const glm::ivec2& offset : ring_offsets) {
+		glm::ivec2 coords = center + offset;
+		if (resident.count(key(coords)) || pending.count(key(coords)))
+			continue;
+		ring_requested = false;
+		if (in_flight >= max_jobs)
+			break;
+		request(coords, false);
+		in_flight++;
+	}
+	// prefetch only once the whole ring is on its way, and into half the job slots, so a tile that comes into view
+	// waits for at most one round of predicted ones
+	if (ring_requested)
+		for (const glm::ivec2& coords : predicted) {
+			if (in_flight >= max_jobs / 2)
+				break;
+			if (resident.count(key(coords)) || pending.count(key(coords)))
+				continue;
+			request(coords, true);
+			in_flight++;
+		}
+
+	// resident ring tiles inside the frustum, bounded by the whole height range
+	Frustum frustum(view_projection);
+	glm::vec3 extent(TILE_SIZE * 0.5f, height_scale * 0.5f, TILE_SIZE * 0.5f);
+	instances.clear();
+	missing_tiles = 0;
+	for (const glm::ivec2& offset : ring_offsets) {
+		glm::ivec2 coords = center + offset;
+		glm::vec3 box_center(((float)coords.x + 0.5f) * TILE_SIZE, height_scale * 0.5f - height_shift, ((float)coords.y + 0.5f) * TILE_SIZE);
+		bool outside = false;
+		for (const glm::vec4& plane : frustum.planes)
+			outside = outside || glm::dot(glm::vec3(plane), box_center) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) < 0.0f;
+		if (outside)
+			continue;
+		auto tile = resident.find(key(coords));
+		if (tile != resident.end())
+			instances.emplace_back(coords.x, coords.y, tile->second.layer, 0);
+		else
+			missing_tiles++;
+	}
+	glNamedBufferData(instance_buffer, instances.size() * sizeof(glm::ivec4), instances.data(), GL_STREAM_DRAW);
+}
+
+void TileStreamer::predict(const glm::vec3& eye, const glm::vec3& forward)
+{
+	glm::vec2 position(eye.x, eye.z);
+	float heading = std::atan2(forward.z, forward.x);
+	if (tracking) {
+		glm::vec2 step = position - last_position;
+		// a jump says nothing about where the camera goes next
+		if (glm::length(step) > TILE_SIZE) {
+			velocity = glm::vec2(0.0f);
+			turn_rate = 0.0f;
+		}
+		else {
+			float turn = heading - last_heading;
+			turn -= glm::two_pi<float>() * std::floor((turn + glm::pi<float>()) / glm::two_pi<float>());
+			velocity = glm::mix(velocity, step, PREDICTION_SMOOTHING);
+			turn_rate = glm::mix(turn_rate, turn, PREDICTION_SMOOTHING);
+		}
+	}
+	tracking = true;
+	last_position = position;
+	last_heading = heading;
+
+	predicted.clear();
+	predicted_order.clear();
+	if (prefetch_frames <= 0 || glm::length(velocity) < 1e-3f)
+		return;
+	// walk the path frame by frame, turning the velocity at the current rate, and collect the tiles the ring takes in
+	// at every tile crossed, nearest to the crossing first
+	float cos_turn = std::cos(turn_rate), sin_turn = std::sin(turn_rate);
+	glm::vec2 p = position, v = velocity;
+	glm::ivec2 last_tile = center;
+	for (int frame = 0; frame < prefetch_frames; frame++) {
+		p += v;
+		v = glm::vec2(cos_turn * v.x - sin_turn * v.y, sin_turn * v.x + cos_turn * v.y);
+		glm::ivec2 tile = glm::ivec2(glm::floor(p / (float)TILE_SIZE));
+		if (tile == last_tile)
+			continue;
+		last_tile = tile;
+		for (const glm::ivec2& offset : ring_offsets) {
+			glm::ivec2 coords = tile + offset;
+			if (in_ring(coords) || predicted_order.count(key(coords)))
+				continue;
+			predicted_order[key(coords)] = (int)predicted.size();
+			predicted.push_back(coords);
+		}
+	}
+}
+
+void TileStreamer::request(glm::ivec2 coords, bool prefetch)
+{
+	Request& request = pending[key(coords)];
+	request.prefetched = prefetch;
+	request.used = !prefetch;
+	requested_tiles++;
+	if (prefetch)
+		prefetched_tiles++;
+	else
+		demand_tiles++;
+	pool->submit([this, coords] {
+		TileData data;
+		data.coords = coords;
+		std::vector<float> rgba((size_t)TILE_SAMPLES * TILE_SAMPLES * NoiseGenerator::NUM_CHANNELS);
+		generator.generate_region(noise_settings, coords.x * TILE_SIZE, coords.y * TILE_SIZE, TILE_SAMPLES, TILE_SAMPLES, rgba.data(), (size_t)TILE_SAMPLES * NoiseGenerator::NUM_CHANNELS);
+		data.height.resize((size_t)TILE_SAMPLES * TILE_SAMPLES);
+		data.biome.resize((size_t)TILE_SAMPLES * TILE_SAMPLES * 2);
+		NoiseGenerator::pack(rgba.data(), data.height.size(), data.height.data(), data.biome.data());
+		std::lock_guard<std::mutex> lock(finished_mutex);
+		finished.push_back(std::move(data));
+	});
+}
+
+int TileStreamer::acquire_layer(glm::ivec2 coords)
+{
+	if (!free_layers.empty()) {
+		int layer = free_layers.back();
+		free_layers.pop_back();
+		return layer;
+	}
+	// ring tiles may evict predicted ones, predicted tiles only what is neither, the rest waits for a free layer
+	bool needed = in_ring(coords);
+	if (lru.empty() || (!needed && !predicted_order.count(key(coords))))
+		return -1;
+	auto victim = resident.find(lru.back());
+	if (in_ring(victim->second.coords) || (!needed && predicted_order.count(lru.back())))
+		return -1;
+	if (victim->second.prefetched && !victim->second.used)
+		wasted_prefetches++;
+	int layer = victim->second.layer;
+	lru.pop_back();
+	resident.erase(victim);
+	evicted_tiles++;
+	return layer;
+}
+
+void TileStreamer::upload(const TileData& data, int layer)
+{
+	glTextureSubImage3D(height_tex, 0, 0, 0, layer, TILE_SAMPLES, TILE_SAMPLES, 1, GL_RED, GL_UNSIGNED_SHORT, data.height.data());
+	glTextureSubImage3D(biome_tex, 0, 0, 0, layer, TILE_SAMPLES, TILE_SAMPLES, 1, GL_RG, GL_UNSIGNED_BYTE, data.biome.data());
+
+	uint64_t k = key(data.coords);
+	lru.push_front(k);
+	Tile& tile = resident[k];
+	tile.coords = data.coords;
+	tile.layer = layer;
+	tile.lru_entry = lru.begin();
+	tile.prefetched = pending[k].prefetched;
+	tile.used = pending[k].used;
+	pending.erase(k);
+}
+
+void TileStreamer::set_uniforms(Camera*, glm::mat4 view_projection)
+{
+	shader->use();
+	shader->setMat4("model", view_projection);
+	shader->setFloat("height_scale", height_scale);
+	shader->setFloat("height_shift", height_shift);
+	shader->setInt("tile_size", TILE_SIZE);
+	shader->setInt("height_data", 0);
+	shader->setInt("biome_data", 1);
+}
+
+void TileStreamer::draw()
+{
+	if (instances.empty())
+		return;
+	shader->use();
+	glBindTextureUnit(0, height_tex);
+	glBindTextureUnit(1, biome_tex);
+	glBindVertexArray(VAO);
+	glDrawElementsInstanced(GL_TRIANGLES, tile_indices, GL_UNSIGNED_SHORT, nullptr, (GLsizei)instances.size());
+	glBindVertexArray(0);
+}
+
+void TileStreamer::gen_mesh()
+{
+	glGenVertexArrays(1, &VAO);
+	glBindVertexArray(VAO);
+
+	// TILE_SAMPLES^2 corners, corner (i, j) at i * TILE_SAMPLES + j, two triangles per quad
+	std::vector<GLushort> corners;
+	corners.reserve((size_t)TILE_SAMPLES * TILE_SAMPLES * 2);
+	for (int i = 0; i < TILE_SAMPLES; i++)
+		for (int j = 0; j < TILE_SAMPLES; j++)
+			corners.insert(corners.end(), { (GLushort)i, (GLushort)j });
+	std::vector<GLushort> indices;
+	indices.reserve((size_t)TILE_SIZE * TILE_SIZE * 6);
+	for (int i = 0; i < TILE_SIZE; i++)
+		for (int j = 0; j < TILE_SIZE; j++) {
+			GLushort corner = (GLushort)(i * TILE_SAMPLES + j);
+			indices.insert(indices.end(), { corner, (GLushort)(corner + TILE_SAMPLES), (GLushort)(corner + 1), (GLushort)(corner + 1), (GLushort)(corner + TILE_SAMPLES), (GLushort)(corner + TILE_SAMPLES + 1) });
+		}
+	tile_indices = (GLsizei)indices.size();
+
+	glGenBuffers(1, &VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(GLushort), corners.data(), GL_STATIC_DRAW);
+	int grid_location = glGetAttribLocation(shader->ID, "v_grid");
+	glVertexAttribPointer(grid_location, 2, GL_UNSIGNED_SHORT, GL_FALSE, 2 * sizeof(GLushort), (void*)0);
+	glEnableVertexAttribArray(grid_location);
+
+	// one (x, z, layer) per drawn tile, refilled by update()
+	glGenBuffers(1, &instance_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	int tile_location = glGetAttribLocation(shader->ID, "v_tile");
+	glVertexAttribIPointer(tile_location, 4, GL_INT, sizeof(glm::ivec4), (void*)0);
+	glVertexAttribDivisor(tile_location, 1);
+	glEnableVertexAttribArray(tile_location);
+
+	glGenBuffers(1, &EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include "shader.h"
+#include "scene_object.h"
+#include "camera.h"
+#include "noise_settings.h"
+#include "noise_generator.h"
+#include "thread_pool.h"
+
+// Infinite terrain streamed in square tiles around the camera.
+// The world is split into tiles of TILE_SIZE x TILE_SIZE quads keyed by their integer coordinates; tile (x, z) covers
+// the samples [x * TILE_SIZE, (x + 1) * TILE_SIZE] along both axes, so neighbouring tiles share their edge samples and
+// meet without cracks. Every frame the tiles within ring_radius of the camera tile are requested nearest first, and
+// worker threads generate them on the CPU (NoiseGenerator) in the packed R16 + RG8 format. Finished tiles are uploaded
+// into one layer of a pair of texture arrays, at most upload_budget per frame, and the whole ring is drawn with one
+// instanced call. The arrays hold as many layers as fit in the memory budget; once full, the least recently used
+// tile outside the ring gives its layer up. The render thread never waits for the noise, and its per-frame work is
+// bounded by the ring and the upload budget, whatever the distance flown.
+//
+// To have tiles ready before they come into view, update() also extrapolates the camera's path from the last frames'
+// position and heading deltas: the velocity keeps turning at the current turn rate for prefetch_frames frames, and
+// the tiles the ring would take in along the way are requested, in the order the camera should reach them, whenever
+// the ring itself has nothing left to request. Counters tell how many prefetched tiles were resident by the time
+// they were needed (hits), were still on their way (late), or were evicted or dropped unused (wasted), against the
+// ring tiles that had to be requested on demand.
+class TileStreamer : public SceneObject {
+public:
+	// quads per tile side, the tile textures hold TILE_SIZE + 1 samples per side
+	static const int TILE_SIZE = 128;
+	static const int TILE_SAMPLES = TILE_SIZE + 1;
+
+	// keep em public cause its easier to manage
+	float height_scale = 128.0f, height_shift = 64.0f;
+	// Chebyshev distance in tiles from the camera tile of the tiles kept resident and drawn
+	int ring_radius = 4;
+	// tile uploads per frame at most
+	unsigned int upload_budget = 2;
+	// frames of predicted camera path to prefetch tiles along, 0 disables prefetching
+	int prefetch_frames = 90;
+
+	// memory_budget is in bytes of GPU memory for the tile arrays; num_threads = 0 leaves one hardware thread to the
+	// render loop
+	TileStreamer(Shader* shader, NoiseSettings noise_settings, size_t memory_budget = 32 * 1024 * 1024, unsigned int num_threads = 0);
+	~TileStreamer();
+	// requests the tiles around the eye and along its predicted path, uploads the finished ones and culls the resident
+	// ring against the frustum; call once per frame with the camera position and forward vector
+	void update(const glm::mat4& view_projection, const glm::vec3& eye, const glm::vec3& forward);
+	void set_uniforms(Camera* camera, glm::mat4 view_projection);
+	void draw();
+
+	// tiles the arrays can hold
+	unsigned int get_capacity() const { return capacity; }
+	unsigned int get_num_resident() const { return (unsigned int)resident.size(); }
+	// tiles requested and not uploaded yet, generating or waiting for an upload slot
+	unsigned int get_num_pending() const { return (unsigned int)pending.size(); }
+	unsigned int get_num_drawn() const { return (unsigned int)instances.size(); }
+	// ring tiles inside the frustum that were not resident in the last update(), i.e. holes on screen
+	unsigned int get_num_missing() const { return missing_tiles; }
+	// tiles along the predicted path in the last update()
+	unsigned int get_num_predicted() const { return (unsigned int)predicted.size(); }
+	// uploads in the last update()
+	unsigned int get_uploads() const { return uploads; }
+	// totals since construction
+	size_t get_requested_tiles() const { return requested_tiles; }
+	size_t get_evicted_tiles() const { return evicted_tiles; }
+	// tiles that finished generating after they had left the ring, thrown away unused
+	size_t get_dropped_tiles() const { return dropped_tiles; }
+	// ring tiles requested when already needed, and predicted tiles requested ahead of time
+	size_t get_demand_tiles() const { return demand_tiles; }
+	size_t get_prefetched_tiles() const { return prefetched_tiles; }
+	size_t get_prefetch_hits() const { return prefetch_hits; }
+	size_t get_prefetch_late() const { return prefetch_late; }
+	size_t get_wasted_prefetches() const { return wasted_prefetches; }
+	// bytes of GPU memory taken by the tile arrays
+	size_t get_data_size() const { return (size_t)capacity * LAYER_SIZE; }
+	// the tile the eye is over
+	static glm::ivec2 tile_at(const glm::vec3& position);
+
+private:
+	// bytes of one tile layer: R16 height + RG8 moisture/other
+	static const size_t LAYER_SIZE = (size_t)TILE_SAMPLES * TILE_SAMPLES * 4;
+
+	struct Tile {
+		glm::ivec2 coords;
+		int layer = -1;
+		// position in lru
+		std::list<uint64_t>::iterator lru_entry;
+		// requested by the predictor, and entered the ring since
+		bool prefetched = false;
+		bool used = false;
+	};
+	struct Request {
+		bool prefetched = false;
+		bool used = false;
+	};
+	// a generated tile on its way from a worker to the arrays
+	struct TileData {
+		glm::ivec2 coords;
+		std::vector<uint16_t> height;
+		std::vector<uint8_t> biome;
+	};
+
+	// shader program
+	Shader* shader = nullptr;
+
+	NoiseSettings noise_settings;
+	NoiseGenerator generator;
+
+	GLuint height_tex = 0;
+	GLuint biome_tex = 0;
+	unsigned int capacity = 0;
+	std::vector<int> free_layers;
+
+	std::unordered_map<uint64_t, Tile> resident;
+	// resident tile keys, most recently used first
+	std::list<uint64_t> lru;
+	// the requested tiles not resident yet
+	std::unordered_map<uint64_t, Request> pending;
+	// finished tiles waiting for an upload slot
+	std::vector<TileData> staged;
+	// written by the workers
+	std::mutex finished_mutex;
+	std::vector<TileData> finished;
+
+	// ring offsets sorted by distance, rebuilt when ring_radius changes
+	std::vector<glm::ivec2> ring_offsets;
+	int ring_offsets_radius = -1;
+	glm::ivec2 center = glm::ivec2(0);
+
+	// weight of the newest frame in the running averages of the camera motion
+	static constexpr float PREDICTION_SMOOTHING = 0.25f;
+	bool tracking = false;
+	glm::vec2 last_position = glm::vec2(0.0f);
+	float last_heading = 0.0f;
+	// xz texels and radians per frame
+	glm::vec2 velocity = glm::vec2(0.0f);
+	float turn_rate = 0.0f;
+	// tiles outside the ring along the predicted path, and their index in it
+	std::vector<glm::ivec2> predicted;
+	std::unordered_map<uint64_t, int> predicted_order;
+
+	// tile grid mesh plus one (x, z, layer) instance per drawn tile
+	GLuint VAO = 0;
+	GLuint VBO = 0;
+	GLuint EBO = 0;
+	GLuint instance_buffer = 0;
+	GLsizei tile_indices = 0;
+	std::vector<glm::ivec4> instances;
+
+	unsigned int uploads = 0;
+	unsigned int missing_tiles = 0;
+	size_t requested_tiles = 0, evicted_tiles = 0, dropped_tiles = 0;
+	size_t demand_tiles = 0, prefetched_tiles = 0, prefetch_hits = 0, prefetch_late = 0, wasted_prefetches = 0;
+
+	// declared last so it is destroyed first, finishing the queued tiles while the rest is still alive
+	std::unique_ptr<ThreadPool> pool;
+	unsigned int max_jobs = 0;
+
+	void gen_mesh();
+	// updates the motion averages and rebuilds predicted
+	void predict(const glm::vec3& eye, const glm::vec3& forward);
+	void request(glm::ivec2 coords, bool prefetch);
+	void upload(const TileData& data, int layer);
+	// a layer for the tile, free or taken from the least recently used tile it may evict; -1 if there is none
+	int acquire_layer(glm::ivec2 coords);
+	bool in_ring(glm::ivec2 coords, int margin = 0) const;
+
+	static uint64_t key(glm::ivec2 coords) { return ((uint64_t)(uint32_t)coords.x << 32) | (uint32_t)coords.y; }
+};
@@ -0,0 +1,129 @@
+#include "workgroup_tuner.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+const glm::ivec2 WorkgroupTuner::DEFAULT_SIZE = glm::ivec2(8, 4);
+
+// side of the square texture the candidates are timed on
+static const unsigned int TUNE_TEXTURE_SIZE = 1024;
+// timed dispatches per candidate, the fastest one counts
+static const int TUNE_REPETITIONS = 3;
+
+WorkgroupTuner::WorkgroupTuner(const char* shader_path, const char* cache_path)
+	: shader_path(shader_path), cache_path(cache_path)
+{
+	device_key = std::string((const char*)glGetString(GL_VENDOR)) + "|" + (const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION);
+	// the key is stored tab separated on a single line
+	std::replace(device_key.begin(), device_key.end(), '\t', ' ');
+	std::replace(device_key.begin(), device_key.end(), '\n', ' ');
+	load_cache();
+}
+
+glm::ivec2 WorkgroupTuner::get_local_size() const
+{
+	auto entry = cache.find(device_key);
+	return entry == cache.end() ? DEFAULT_SIZE : entry->second;
+}
+
+std::string WorkgroupTuner::make_prelude(glm::ivec2 local_size)
+{
+	return "#define LOCAL_SIZE_X " + std::to_string(local_size.x) + "\n#define LOCAL_SIZE_Y " + std::to_string(local_size.y) + "\n";
+}
+
+ComputeShader* WorkgroupTuner::create_generator(glm::ivec2 local_size, Terrain::DataFormat format) const
+{
+	return new ComputeShader(shader_path.c_str(), make_prelude(local_size) + Terrain::generator_prelude(format));
+}
+
+double WorkgroupTuner::time_variant(glm::ivec2 local_size, Terrain::DataFormat format, const NoiseSettings& settings, GLuint data_tex, GLuint biome_tex, unsigned int tex_size) const
+{
+	ComputeShader* variant = create_generator(local_size, format);
+	Terrain::set_generator_uniforms(variant, settings);
+	Terrain::bind_data_images(format, data_tex, biome_tex);
+	GLuint groups_x = (tex_size + local_size.x - 1) / local_size.x;
+	GLuint groups_y = (tex_size + local_size.y - 1) / local_size.y;
+
+	// warm up, the driver may finish compiling on first use
+	glDispatchCompute(groups_x, groups_y, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	GLuint timers[TUNE_REPETITIONS];
+	glGenQueries(TUNE_REPETITIONS, timers);
+	for (int i = 0; i < TUNE_REPETITIONS; i++) {
+		glBeginQuery(GL_TIME_ELAPSED, timers[i]);
+		glDispatchCompute(groups_x, groups_y, 1);
+		glEndQuery(GL_TIME_ELAPSED);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	GLuint64 best = ~(GLuint64)0;
+	for (int i = 0; i < TUNE_REPETITIONS; i++) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(timers[i], GL_QUERY_RESULT, &elapsed);
+		best = std::min(best, elapsed);
+	}
+	glDeleteQueries(TUNE_REPETITIONS, timers);
+	glDeleteProgram(variant->ID);
+	delete variant;
+	return best / 1e6;
+}
+
+glm::ivec2 WorkgroupTuner::tune(const NoiseSettings& settings, Terrain::DataFormat format)
+{
+	const glm::ivec2 candidates[] = {
+		{ 8, 4 }, { 4, 4 }, { 8, 8 }, { 16, 4 }, { 16, 8 }, { 16, 16 }, { 32, 1 }, { 32, 4 }, { 32, 8 }, { 32, 16 }, { 64, 1 }, { 64, 4 }
+	};
+	GLint max_invocations, max_x, max_y;
+	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &max_x);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &max_y);
+
+	GLuint data_tex = 0, biome_tex = 0;
+	Terrain::create_data_textures(TUNE_TEXTURE_SIZE, TUNE_TEXTURE_SIZE, format, data_tex, biome_tex);
+
+	glm::ivec2 best_size = DEFAULT_SIZE;
+	double best_ms = -1.0;
+	for (auto size : candidates) {
+		if (size.x > max_x || size.y > max_y || size.x * size.y > max_invocations)
+			continue;
+		double ms = time_variant(size, format, settings, data_tex, biome_tex, TUNE_TEXTURE_SIZE);
+		std::cout << "Generator work group " << size.x << "x" << size.y << ": " << ms << " ms" << std::endl;
+		if (best_ms < 0.0 || ms < best_ms) {
+			best_ms = ms;
+			best_size = size;
+		}
+	}
+	glDeleteTextures(1, &data_tex);
+	if (biome_tex)
+		glDeleteTextures(1, &biome_tex);
+
+	std::cout << "Fastest generator work group: " << best_size.x << "x" << best_size.y << std::endl;
+	cache[device_key] = best_size;
+	save_cache();
+	return best_size;
+}
+
+void WorkgroupTuner::load_cache()
+{
+	std::ifstream file(cache_path);
+	std::string line;
+	while (std::getline(file, line)) {
+		size_t tab = line.find('\t');
+		if (tab == std::string::npos)
+			continue;
+		std::istringstream sizes(line.substr(tab + 1));
+		glm::ivec2 size;
+		if (sizes >> size.x >> size.y && size.x > 0 && size.y > 0)
+			cache[line.substr(0, tab)] = size;
+	}
+}
+
+void WorkgroupTuner::save_cache() const
+{
+	std::ofstream file(cache_path);
+	for (auto& entry : cache)
+		file << entry.first << '\t' << entry.second.x << '\t' << entry.second.y << '\n';
+	if (!file)
+		std::cout << "Failed to write work group cache " << cache_path << std::endl;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <map>
+#include <glm/glm.hpp>
+#include "compute_shader.h"
+#include "noise_settings.h"
+#include "terrain.h"
+
+// Picks the work group size of the terrain generator (shaders/terrain_gen.comp) for the running GPU.
+// tune() compiles the generator once per candidate size, passing LOCAL_SIZE_X/Y through the ComputeShader prelude,
+// times a dispatch of each with GL timer queries and keeps the fastest. Results are stored per driver/GPU in a small
+// text file (one "vendor|renderer|version<TAB>x<TAB>y" line per device), so later runs start with the tuned size.
+class WorkgroupTuner {
+private:
+	std::string shader_path;
+	std::string cache_path;
+	// GL_VENDOR, GL_RENDERER and GL_VERSION of the current context
+	std::string device_key;
+	std::map<std::string, glm::ivec2> cache;
+
+	void load_cache();
+	void save_cache() const;
+	// GPU time in ms of one generator dispatch into tex_size x tex_size textures of the given format
+	double time_variant(glm::ivec2 local_size, Terrain::DataFormat format, const NoiseSettings& settings, GLuint data_tex, GLuint biome_tex, unsigned int tex_size) const;
+
+public:
+	// size the shader declares when nothing was tuned yet
+	static const glm::ivec2 DEFAULT_SIZE;
+
+	// needs a current GL context
+	WorkgroupTuner(const char* shader_path, const char* cache_path);
+
+	// tuned size for the current GPU, DEFAULT_SIZE if it was never tuned
+	glm::ivec2 get_local_size() const;
+	bool is_tuned() const { return cache.count(device_key) > 0; }
+	// compiles the generator with the given work group size, writing the given storage format
+	ComputeShader* create_generator(glm::ivec2 local_size, Terrain::DataFormat format) const;
+	// benchmarks all candidate sizes generating the given format, stores the fastest for the current GPU and returns it
+	glm::ivec2 tune(const NoiseSettings& settings, Terrain::DataFormat format);
+
+	static std::string make_prelude(glm::ivec2 local_size);
+};
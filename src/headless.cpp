@@ -0,0 +1,550 @@
+#include "headless.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+#include "fpng.h"
+
+#include "engine/noise_settings.h"
+#include "engine/noise_generator.h"
+#include "engine/thread_pool.h"
+#include "engine/height_pyramid.h"
+#include "engine/terrain.h"
+#include "engine/terrain_file.h"
+#include "engine/tile_codec.h"
+
+/* Headless terrain generation
+* Usage: terrain_lod --headless [--width W] [--height H] [--backend scalar|sse4.1|avx2] [--threads N] [--out file] [--bench] [--packed]
+*     [--tiles file] [--levels N] [--codec raw|delta|med] [--height-error E] [--scale-height-error]
+* Generates the default terrain on the CPU, tiled over N threads (default: all hardware threads), and reports the
+* kernel throughput, then builds the min/max height pyramid over the result. With --out the RGBA32F texels are written as raw row-major floats, the same layout the compute
+* shader produces on the GPU.
+* --bench additionally times the three separate fbm calls against the fused kernel and checks they match, then times
+* band-limited against full fbm for a range of octave counts on a BAND_LIMIT_BENCH_SIZE map, and the map with the
+* analytic slopes of the height against without, checking them against central differences of the heights.
+* --packed converts the result to the R16 + RG8 storage of Terrain::PACKED and reports the height quantisation error;
+* --out then writes the 16 bit height plane followed by the interleaved 8 bit moisture/other plane.
+* --tiles streams the map into a TerrainFile with N mip levels (default 1), generating it a band of tiles at a time, then
+* reads the tiles back, checks them against the packed map and reports the compression and decode throughput. The tiles
+* are compressed with --codec (default med); the level 0 height tiles of the generated map are then compressed with
+* every codec, the MED ones decoded both with and without SIMD, and with fpng as a 24 bit PNG of the high and low bytes
+* for reference.
+* --height-error stores the height tiles lossy within E world units on every level, or E * 2^l on level l with
+* --scale-height-error; every level's heights are checked against the bound on read back.
+* Last, two level 0 height tiles of the file are rewritten, one in place and one appended, and the file read back again.
+*/
+
+// side of the map the octave sweep of --bench generates
+static const unsigned int BAND_LIMIT_BENCH_SIZE = 1024;
+// world units the height errors are reported in, the default height scale of the renderer
+static const float RENDER_HEIGHT_SCALE = 128.0f;
+// world space height errors of the lossy codec compared on the level 0 heights
+static const float COMPARED_HEIGHT_ERRORS[] = { 0.05f, 0.25f, 1.0f };
+
+// generates the map and returns the elapsed seconds
+static double timed_generate(const NoiseGenerator& generator, const NoiseSettings& settings, unsigned int width, unsigned int height, float* out, ThreadPool* pool, float* slope = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    if (pool)
+        generator.generate(settings, width, height, out, *pool, slope);
+    else
+        generator.generate(settings, width, height, out, slope);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// generates the map a band of tile rows at a time into a new terrain file, returns the elapsed seconds or a negative value
+// on an I/O error
+static double write_terrain_file(const std::string& path, const NoiseGenerator& generator, const NoiseSettings& settings, unsigned int width, unsigned int height,
+    unsigned int levels, tile_codec::Codec codec, float height_error, bool scale_height_error, ThreadPool* pool) {
+    auto start = std::chrono::steady_clock::now();
+    TerrainFileWriter writer;
+    writer.codec = codec;
+    writer.height_error = height_error;
+    writer.scale_height_error = scale_height_error;
+    writer.height_scale = RENDER_HEIGHT_SCALE;
+    if (!writer.create(path, settings, width, height, levels))
+        return -1.0;
+    unsigned int band_rows = TerrainFile::DEFAULT_TILE_SIZE;
+    size_t band_texels = (size_t)width * band_rows;
+    std::vector<float> band(band_texels * NoiseGenerator::NUM_CHANNELS), slope(band_texels * 2);
+    std::vector<uint16_t> packed_height(band_texels), packed_slope(band_texels * 2);
+    std::vector<uint8_t> packed_biome(band_texels * 2);
+    unsigned int blocks = (width + NoiseGenerator::TILE_SIZE - 1) / NoiseGenerator::TILE_SIZE;
+    for (unsigned int y = 0; y < height; y += band_rows) {
+        unsigned int rows = std::min(band_rows, height - y);
+        auto generate_block = [&](size_t block) {
+            unsigned int x = (unsigned int)block * NoiseGenerator::TILE_SIZE;
+            unsigned int w = std::min(NoiseGenerator::TILE_SIZE, width - x);
+            generator.generate_region(settings, x, y, w, rows, band.data() + (size_t)x * NoiseGenerator::NUM_CHANNELS, (size_t)width * NoiseGenerator::NUM_CHANNELS,
+                slope.data() + (size_t)x * 2, (size_t)width * 2);
+        };
+        if (pool)
+            pool->parallel_for(blocks, generate_block);
+        else
+            for (unsigned int block = 0; block < blocks; block++)
+                generate_block(block);
+        size_t texels = (size_t)width * rows;
+        NoiseGenerator::pack(band.data(), texels, packed_height.data(), packed_biome.data());
+        for (size_t i = 0; i < texels * 2; i++)
+            packed_slope[i] = glm::packHalf1x16(slope[i]);
+        if (!writer.write_rows(packed_height.data(), packed_biome.data(), packed_slope.data(), rows))
+            return -1.0;
+    }
+    writer.close();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// compresses the level 0 height tiles of the file with every codec and reports the ratio and single core decode throughput;
+// the tiles are packed again from the generated map (width texels wide), which the file may only hold lossy
+static void compare_codecs(const TerrainFile& file, const std::vector<float>& data, unsigned int width) {
+    std::vector<tile_codec::Layout> layouts;
+    std::vector<std::vector<uint16_t>> heights;
+    std::vector<uint8_t> biome;
+    unsigned int tile_size = file.get_tile_size();
+    glm::uvec2 count = file.get_tile_count(0);
+    for (unsigned int ty = 0; ty < count.y; ty++)
+        for (unsigned int tx = 0; tx < count.x; tx++) {
+            tile_codec::Layout layout = TerrainFile::get_layout(TerrainFile::HEIGHT, file.get_tile_texels(0, tx, ty));
+            heights.emplace_back(layout.width * layout.height);
+            biome.resize(layout.width * 2);
+            for (unsigned int y = 0; y < layout.height; y++) {
+                size_t first = ((size_t)(ty * tile_size + y)) * width + tx * tile_size;
+                NoiseGenerator::pack(data.data() + first * NoiseGenerator::NUM_CHANNELS, layout.width, heights.back().data() + (size_t)y * layout.width, biome.data());
+            }
+            layouts.push_back(layout);
+        }
+    size_t raw_bytes = 0;
+    for (auto& layout : layouts)
+        raw_bytes += layout.get_size();
+
+    std::vector<uint16_t> decoded;
+    auto report = [&](const std::string& name, size_t stored_bytes, double seconds, bool matches) {
+        std::cout << "    " << name << ": ratio " << (double)raw_bytes / stored_bytes << ", " << raw_bytes / seconds / (1024 * 1024)
+            << " MiB/s decoded" << (matches ? "" : " (MISMATCH)") << std::endl;
+    };
+    std::cout << "Level 0 heights, " << raw_bytes / (1024 * 1024) << " MiB:" << std::endl;
+    // the codecs, then the lossy one at every compared error
+    std::vector<std::pair<tile_codec::Codec, float>> candidates = { { tile_codec::RAW, 0.0f }, { tile_codec::DELTA, 0.0f }, { tile_codec::MED, 0.0f } };
+    for (float error : COMPARED_HEIGHT_ERRORS)
+        candidates.emplace_back(tile_codec::MED_LOSSY, error);
+    for (auto& candidate : candidates)
+        for (bool simd : { false, true }) {
+            tile_codec::Codec codec = candidate.first;
+            bool med = codec == tile_codec::MED || codec == tile_codec::MED_LOSSY;
+            if (simd && (!med || !tile_codec::has_simd()))
+                continue;
+            unsigned int max_error = TerrainFile::get_height_error_steps(candidate.second, RENDER_HEIGHT_SCALE);
+            std::vector<std::vector<uint8_t>> encoded(layouts.size());
+            size_t stored_bytes = 0;
+            for (size_t t = 0; t < layouts.size(); t++) {
+                tile_codec::encode(codec, layouts[t], heights[t].data(), encoded[t], max_error);
+                stored_bytes += encoded[t].size();
+            }
+            double seconds = 0.0;
+            bool matches = true;
+            for (size_t t = 0; t < layouts.size(); t++) {
+                decoded.resize(heights[t].size());
+                auto start = std::chrono::steady_clock::now();
+                matches &= tile_codec::decode(codec, layouts[t], encoded[t].data(), encoded[t].size(), decoded.data(), simd);
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                seconds += elapsed.count();
+                for (size_t i = 0; i < decoded.size(); i++)
+                    matches &= (unsigned int)std::abs((int)decoded[i] - (int)heights[t][i]) <= max_error;
+            }
+            std::string name = tile_codec::codec_name(codec);
+            if (codec == tile_codec::MED_LOSSY) {
+                std::ostringstream error;
+                error << " " << candidate.second << " units";
+                name += error.str();
+            }
+            if (med)
+                name += simd ? " (sse4.1)" : " (scalar)";
+            report(name, stored_bytes, seconds, matches);
+        }
+
+    // fpng only takes 8 bit channels: the high byte in red, the low byte in green
+    fpng::fpng_init();
+    size_t stored_bytes = 0;
+    double seconds = 0.0;
+    bool matches = true;
+    std::vector<uint8_t> rgb, png, pixels;
+    for (size_t t = 0; t < layouts.size(); t++) {
+        const std::vector<uint16_t>& tile = heights[t];
+        rgb.assign(tile.size() * 3, 0);
+        for (size_t i = 0; i < tile.size(); i++) {
+            rgb[i * 3] = (uint8_t)(tile[i] >> 8);
+            rgb[i * 3 + 1] = (uint8_t)tile[i];
+        }
+        png.clear();
+        if (!fpng::fpng_encode_image_to_memory(rgb.data(), layouts[t].width, layouts[t].height, 3, png))
+            return;
+        stored_bytes += png.size();
+        uint32_t w, h, channels;
+        auto start = std::chrono::steady_clock::now();
+        matches &= fpng::fpng_decode_memory(png.data(), (uint32_t)png.size(), pixels, w, h, channels, 3) == fpng::FPNG_DECODE_SUCCESS;
+        decoded.resize(tile.size());
+        for (size_t i = 0; i < tile.size() && matches; i++)
+            decoded[i] = (uint16_t)(pixels[i * 3] << 8 | pixels[i * 3 + 1]);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        seconds += elapsed.count();
+        matches &= decoded == tile;
+    }
+    report("fpng", stored_bytes, seconds, matches);
+}
+
+// the heights of the next mip level of a size.x x size.y level, box filtered like TerrainFileWriter builds them
+static std::vector<uint16_t> downsample_heights(const std::vector<uint16_t>& heights, glm::uvec2 size) {
+    glm::uvec2 next_size = (size + 1u) / 2u;
+    std::vector<uint16_t> next((size_t)next_size.x * next_size.y);
+    for (unsigned int y = 0; y < next_size.y; y++)
+        for (unsigned int x = 0; x < next_size.x; x++) {
+            unsigned int x0 = 2 * x, x1 = std::min(2 * x + 1, size.x - 1);
+            unsigned int y0 = 2 * y, y1 = std::min(2 * y + 1, size.y - 1);
+            next[(size_t)y * next_size.x + x] = (uint16_t)((heights[(size_t)y0 * size.x + x0] + heights[(size_t)y0 * size.x + x1]
+                + heights[(size_t)y1 * size.x + x0] + heights[(size_t)y1 * size.x + x1] + 2) / 4);
+        }
+    return next;
+}
+
+// bytes of the file at path, 0 if it can't be read
+static uint64_t file_size(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file ? (uint64_t)file.tellg() : 0;
+}
+
+// Rewrites two level 0 height tiles of an existing file: the first corner with a flat tile, smaller than the one it
+// replaces so it stays in its slot, then the last corner with RAW noise, appended when it is larger than the generated
+// tile. Reopens the file after each and checks the rewritten tile reads back and the other tiles are unchanged.
+static bool check_rewrites(const std::string& path) {
+    TerrainFile file;
+    if (!file.open(path))
+        return false;
+    glm::uvec2 count = file.get_tile_count(0);
+    std::vector<std::vector<uint16_t>> tiles(count.x * count.y);
+    for (unsigned int ty = 0; ty < count.y; ty++)
+        for (unsigned int tx = 0; tx < count.x; tx++) {
+            std::vector<uint16_t>& tile = tiles[ty * count.x + tx];
+            glm::uvec2 size = file.get_tile_texels(0, tx, ty);
+            tile.resize(size.x * size.y);
+            if (!file.read_tile(0, tx, ty, TerrainFile::HEIGHT, tile.data()))
+                return false;
+        }
+    glm::uvec2 corners[2] = { glm::uvec2(0), count - 1u };
+    size_t stored_bytes = file.get_tile_bytes(0, corners[1].x, corners[1].y, TerrainFile::HEIGHT);
+    file.close();
+
+    bool matches = true, appended = false;
+    for (unsigned int r = 0; r < 2; r++) {
+        glm::uvec2 corner = corners[r];
+        std::vector<uint16_t>& tile = tiles[corner.y * count.x + corner.x];
+        for (size_t i = 0; i < tile.size(); i++)
+            tile[i] = r == 0 ? 32768 : (uint16_t)((i * 2654435761u) >> 13);
+        uint64_t size_before = file_size(path);
+        TerrainFileWriter writer;
+        writer.codec = r == 0 ? tile_codec::MED : tile_codec::RAW;
+        if (!writer.open(path) || !writer.write_tile(0, corner.x, corner.y, TerrainFile::HEIGHT, tile.data()))
+            return false;
+        writer.close();
+        // the flat tile in place; the noise appended after the rest, unless the generated tile was already RAW
+        size_t raw_bytes = tile.size() * 2;
+        bool append = r == 1 && raw_bytes > stored_bytes;
+        matches &= file_size(path) == (append ? size_before + raw_bytes : size_before);
+        appended |= append;
+
+        if (!file.open(path))
+            return false;
+        std::vector<uint16_t> texels;
+        for (unsigned int ty = 0; ty < count.y; ty++)
+            for (unsigned int tx = 0; tx < count.x; tx++) {
+                glm::uvec2 size = file.get_tile_texels(0, tx, ty);
+                texels.resize(size.x * size.y);
+                matches &= file.read_tile(0, tx, ty, TerrainFile::HEIGHT, texels.data()) && texels == tiles[ty * count.x + tx];
+            }
+        file.close();
+    }
+    std::cout << "Rewrote a level 0 height tile in place and one " << (appended ? "appended" : "in place (the generated one was RAW)")
+        << (matches ? " (both read back, the other tiles unchanged)" : " (MISMATCH)") << std::endl;
+    return matches;
+}
+
+static bool parse_backend(const std::string& name, NoiseGenerator::Backend& backend) {
+    for (auto candidate : { NoiseGenerator::SCALAR, NoiseGenerator::SSE41, NoiseGenerator::AVX2 })
+        if (name == NoiseGenerator::backend_name(candidate)) {
+            backend = candidate;
+            return true;
+        }
+    return false;
+}
+
+static bool parse_codec(const std::string& name, tile_codec::Codec& codec) {
+    for (auto candidate : { tile_codec::RAW, tile_codec::DELTA, tile_codec::MED })
+        if (name == tile_codec::codec_name(candidate)) {
+            codec = candidate;
+            return true;
+        }
+    return false;
+}
+
+int run_headless(int argc, char** argv) {
+    unsigned int width = 8192, height = 8192;
+    NoiseGenerator::Backend backend = NoiseGenerator::detect_backend();
+    unsigned int num_threads = 0;
+    std::string out_path, tiles_path;
+    unsigned int levels = 1;
+    tile_codec::Codec codec = tile_codec::MED;
+    float height_error = 0.0f;
+    bool scale_height_error = false;
+    bool bench = false, packed = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--headless")
+            continue;
+        if (arg == "--width" && has_value)
+            width = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--height" && has_value)
+            height = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--threads" && has_value)
+            num_threads = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--bench")
+            bench = true;
+        else if (arg == "--packed")
+            packed = true;
+        else if (arg == "--out" && has_value)
+            out_path = argv[++i];
+        else if (arg == "--tiles" && has_value)
+            tiles_path = argv[++i];
+        else if (arg == "--levels" && has_value)
+            levels = (unsigned int)std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--height-error" && has_value)
+            height_error = std::strtof(argv[++i], nullptr);
+        else if (arg == "--scale-height-error")
+            scale_height_error = true;
+        else if (arg == "--codec" && has_value) {
+            if (!parse_codec(argv[++i], codec)) {
+                std::cout << "Unknown codec " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        else if (arg == "--backend" && has_value) {
+            if (!parse_backend(argv[++i], backend)) {
+                std::cout << "Unknown backend " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        else {
+            std::cout << "Unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+    if (width == 0 || height == 0 || levels == 0) {
+        std::cout << "Invalid terrain size" << std::endl;
+        return -1;
+    }
+
+    NoiseGenerator generator(backend);
+    if (generator.get_backend() != backend)
+        std::cout << "Backend " << NoiseGenerator::backend_name(backend) << " not supported by this CPU, falling back" << std::endl;
+    NoiseSettings settings = NoiseSettings::defaults();
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    // parallel_for runs tasks on the calling thread as well, so the pool needs one worker less
+    std::unique_ptr<ThreadPool> pool;
+    if (num_threads > 1)
+        pool.reset(new ThreadPool(num_threads - 1));
+
+    std::vector<float> data((size_t)width * height * NoiseGenerator::NUM_CHANNELS);
+    std::cout << "Generating " << width << "x" << height << " terrain on the CPU (" << generator.get_backend_name() << ", " << num_threads << " threads)" << std::endl;
+
+    double elapsed = timed_generate(generator, settings, width, height, data.data(), pool.get());
+    double mtexels = (double)width * height / elapsed / 1e6;
+    std::cout << "Generated in " << elapsed << " s, " << mtexels << " Mtexels/s, " << mtexels / num_threads << " Mtexels/s per core" << std::endl;
+
+    HeightPyramid pyramid;
+    auto pyramid_start = std::chrono::steady_clock::now();
+    pyramid.build(width, height, data.data(), NoiseGenerator::NUM_CHANNELS);
+    std::chrono::duration<double> pyramid_elapsed = std::chrono::steady_clock::now() - pyramid_start;
+    glm::vec2 range = pyramid.get_cell(pyramid.get_num_levels() - 1, 0, 0);
+    std::cout << "Built height pyramid in " << pyramid_elapsed.count() << " s, " << pyramid.get_num_levels() << " levels, heights in ["
+        << range.x << ", " << range.y << "]" << std::endl;
+
+    if (bench) {
+        std::vector<float> separate(data.size());
+        generator.fused = false;
+        double separate_elapsed = timed_generate(generator, settings, width, height, separate.data(), pool.get());
+        generator.fused = true;
+        std::cout << "Separate fbm calls: " << separate_elapsed << " s, fused fbm: " << elapsed << " s, speedup " << separate_elapsed / elapsed
+            << (separate == data ? " (identical output)" : " (OUTPUT MISMATCH)") << std::endl;
+
+        // octaves fade out from half a lattice cell per texel and are culled from a whole one: at the default settings
+        // only the detail channel's 8th octave (0.64 cells per texel, weight ~0.81) is attenuated, the sweep past 8
+        // octaves shows the culling
+        const unsigned int size = BAND_LIMIT_BENCH_SIZE;
+        std::vector<float> full((size_t)size * size * NoiseGenerator::NUM_CHANNELS), limited(full.size());
+        for (int octaves : { 4, 8, 12, 16 }) {
+            NoiseSettings sweep = settings;
+            sweep.octaves = sweep.biome_octaves = octaves;
+            sweep.band_limit = false;
+            double full_elapsed = timed_generate(generator, sweep, size, size, full.data(), pool.get());
+            sweep.band_limit = true;
+            double limited_elapsed = timed_generate(generator, sweep, size, size, limited.data(), pool.get());
+            double max_diff = 0.0;
+            for (size_t i = 0; i < full.size(); i++)
+                max_diff = std::max(max_diff, (double)std::fabs(full[i] - limited[i]));
+            std::cout << octaves << " octaves: full fbm " << full_elapsed << " s, band-limited " << limited_elapsed << " s, speedup "
+                << full_elapsed / limited_elapsed << ", max difference " << max_diff << std::endl;
+        }
+
+        std::vector<float> slope((size_t)size * size * 2);
+        double plain_elapsed = timed_generate(generator, settings, size, size, full.data(), pool.get());
+        double slope_elapsed = timed_generate(generator, settings, size, size, limited.data(), pool.get(), slope.data());
+        bool same_heights = full == limited;
+        // Central differences only follow the octaves well below a cycle per texel, so the slopes are checked without
+        // the finer ones; as a mean, since they go off over clamped heights and the odd seam in the noise
+        NoiseSettings smooth = settings;
+        smooth.octaves = smooth.biome_octaves = 4;
+        timed_generate(generator, smooth, size, size, limited.data(), pool.get(), slope.data());
+        double mean_slope = 0.0, mean_error = 0.0;
+        for (unsigned int y = 1; y + 1 < size; y++)
+            for (unsigned int x = 1; x + 1 < size; x++) {
+                size_t i = (size_t)y * size + x;
+                const size_t channels = NoiseGenerator::NUM_CHANNELS;
+                float dx = (limited[(i + 1) * channels] - limited[(i - 1) * channels]) * 0.5f;
+                float dy = (limited[(i + size) * channels] - limited[(i - size) * channels]) * 0.5f;
+                mean_slope += std::fabs(slope[i * 2]) + std::fabs(slope[i * 2 + 1]);
+                mean_error += std::fabs(slope[i * 2] - dx) + std::fabs(slope[i * 2 + 1] - dy);
+            }
+        std::cout << "Analytic slopes: " << slope_elapsed << " s, without " << plain_elapsed << " s, overhead " << slope_elapsed / plain_elapsed
+            << (same_heights ? " (same heights)" : " (HEIGHT MISMATCH)") << ", at " << smooth.octaves << " octaves a mean difference to central differences of "
+            << mean_error / mean_slope * 100.0 << "% of the mean slope" << std::endl;
+    }
+
+    size_t num_texels = (size_t)width * height;
+    std::vector<uint16_t> packed_height;
+    std::vector<uint8_t> packed_biome;
+    if (packed) {
+        packed_height.resize(num_texels);
+        packed_biome.resize(num_texels * 2);
+        NoiseGenerator::pack(data.data(), num_texels, packed_height.data(), packed_biome.data());
+        double max_error = 0.0;
+        for (size_t i = 0; i < num_texels; i++)
+            max_error = std::max(max_error, (double)std::fabs(data[i * NoiseGenerator::NUM_CHANNELS] - packed_height[i] / 65535.0f));
+        const float height_scale = RENDER_HEIGHT_SCALE;
+        std::cout << "Packed " << num_texels * 16 / (1024 * 1024) << " MiB to " << num_texels * 4 / (1024 * 1024) << " MiB, max height error "
+            << max_error << " (" << max_error * height_scale << " world units at scale " << height_scale << ", bound "
+            << Terrain::PACKED_HEIGHT_ERROR << ")" << std::endl;
+    }
+
+    if (!out_path.empty()) {
+        std::ofstream out(out_path, std::ios::binary);
+        if (packed) {
+            out.write((const char*)packed_height.data(), packed_height.size() * sizeof(uint16_t));
+            out.write((const char*)packed_biome.data(), packed_biome.size());
+        }
+        else
+            out.write((const char*)data.data(), data.size() * sizeof(float));
+        if (!out) {
+            std::cout << "Failed to write " << out_path << std::endl;
+            return -1;
+        }
+        std::cout << "Wrote " << out_path << std::endl;
+    }
+
+    if (!tiles_path.empty()) {
+        double write_elapsed = write_terrain_file(tiles_path, generator, settings, width, height, levels, codec, height_error, scale_height_error, pool.get());
+        TerrainFile file;
+        if (write_elapsed < 0.0 || !file.open(tiles_path)) {
+            std::cout << "Failed to write " << tiles_path << std::endl;
+            return -1;
+        }
+        std::cout << "Wrote " << tiles_path << " in " << write_elapsed << " s" << std::endl;
+
+        // every tile of every level decoded, the heights of every level checked against the packed map and its box
+        // filtered levels, the level 0 biome against the packed map
+        const char* channel_names[TerrainFile::NUM_CHANNELS] = { "height", "biome", "slope" };
+        size_t raw_bytes[TerrainFile::NUM_CHANNELS] = {}, stored_bytes[TerrainFile::NUM_CHANNELS] = {};
+        double decode_seconds = 0.0;
+        bool matches = true;
+        unsigned int tile_size = file.get_tile_size();
+        std::vector<std::vector<uint16_t>> level_heights(1, std::vector<uint16_t>((size_t)width * height));
+        std::vector<uint8_t> packed_biome((size_t)width * height * 2);
+        NoiseGenerator::pack(data.data(), (size_t)width * height, level_heights[0].data(), packed_biome.data());
+        for (unsigned int level = 1; level < file.get_num_levels(); level++)
+            level_heights.push_back(downsample_heights(level_heights.back(), file.get_level_size(level - 1)));
+        // largest difference of a height of every level to the reference, in 16 bit steps
+        std::vector<unsigned int> height_error_steps(file.get_num_levels(), 0);
+        std::vector<uint8_t> texels;
+        for (unsigned int level = 0; level < file.get_num_levels(); level++) {
+            unsigned int level_width = file.get_level_size(level).x;
+            float level_bound = height_error * (scale_height_error ? (float)(1u << level) : 1.0f);
+            unsigned int bound_steps = TerrainFile::get_height_error_steps(level_bound, RENDER_HEIGHT_SCALE);
+            glm::uvec2 count = file.get_tile_count(level);
+            for (unsigned int ty = 0; ty < count.y; ty++)
+                for (unsigned int tx = 0; tx < count.x; tx++)
+                    for (unsigned int c = 0; c < TerrainFile::NUM_CHANNELS; c++) {
+                        TerrainFile::Channel channel = (TerrainFile::Channel)c;
+                        glm::uvec2 size = file.get_tile_texels(level, tx, ty);
+                        tile_codec::Layout layout = TerrainFile::get_layout(channel, size);
+                        texels.resize(layout.get_size());
+                        auto decode_start = std::chrono::steady_clock::now();
+                        matches &= file.read_tile(level, tx, ty, channel, texels.data());
+                        std::chrono::duration<double> decode_elapsed = std::chrono::steady_clock::now() - decode_start;
+                        decode_seconds += decode_elapsed.count();
+                        raw_bytes[c] += layout.get_size();
+                        stored_bytes[c] += file.get_tile_bytes(level, tx, ty, channel);
+                        if (channel == TerrainFile::SLOPE || (channel == TerrainFile::BIOME && level > 0))
+                            continue;
+                        // lossy height tiles only have to be within the bound they were written with, and it within the level's
+                        unsigned int tile_error = file.get_tile_error(level, tx, ty, channel);
+                        if (channel == TerrainFile::HEIGHT)
+                            matches &= tile_error <= bound_steps;
+                        for (unsigned int y = 0; y < size.y; y++) {
+                            size_t first = ((size_t)(ty * tile_size + y)) * level_width + tx * tile_size;
+                            if (channel == TerrainFile::BIOME) {
+                                matches &= std::equal(packed_biome.begin() + first * 2, packed_biome.begin() + (first + size.x) * 2, texels.data() + (size_t)y * size.x * 2);
+                                continue;
+                            }
+                            const uint16_t* heights = (const uint16_t*)texels.data() + (size_t)y * size.x;
+                            const uint16_t* expected = level_heights[level].data() + first;
+                            for (unsigned int x = 0; x < size.x; x++) {
+                                unsigned int error = (unsigned int)std::abs((int)heights[x] - (int)expected[x]);
+                                height_error_steps[level] = std::max(height_error_steps[level], error);
+                                matches &= error <= tile_error;
+                            }
+                        }
+                    }
+        }
+        size_t total_raw = 0, total_stored = 0;
+        for (unsigned int c = 0; c < TerrainFile::NUM_CHANNELS; c++) {
+            std::cout << "    " << channel_names[c] << ": " << raw_bytes[c] / (1024 * 1024) << " MiB raw, " << stored_bytes[c] / (1024 * 1024)
+                << " MiB stored, ratio " << (double)raw_bytes[c] / stored_bytes[c] << std::endl;
+            total_raw += raw_bytes[c];
+            total_stored += stored_bytes[c];
+        }
+        std::cout << "Read " << file.get_num_levels() << " levels of " << tile_size << " texel tiles back in " << decode_seconds << " s, "
+            << total_raw / decode_seconds / (1024 * 1024) << " MiB/s decoded on one core, ratio " << (double)total_raw / total_stored
+            << (matches ? " (same as the generated map)" : " (MISMATCH)") << std::endl;
+        if (height_error > 0.0f) {
+            std::cout << "Height error in world units at scale " << RENDER_HEIGHT_SCALE << ":";
+            for (unsigned int level = 0; level < file.get_num_levels(); level++)
+                std::cout << (level > 0 ? "," : "") << " level " << level << " " << height_error_steps[level] * RENDER_HEIGHT_SCALE / 65535.0f
+                    << " of " << height_error * (scale_height_error ? (float)(1u << level) : 1.0f);
+            std::cout << std::endl;
+        }
+        compare_codecs(file, data, width);
+        file.close();
+        check_rewrites(tiles_path);
+    }
+    return 0;
+}
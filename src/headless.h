@@ -0,0 +1,5 @@
+#pragma once
+
+// Headless mode, started with `terrain_lod --headless [options]`.
+// Generates the terrain on the CPU without creating a window or GL context, so it can run on machines without a GPU.
+int run_headless(int argc, char** argv);
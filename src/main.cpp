@@ -19,6 +19,12 @@ unsigned int create_vertex_array(const std::vector<float>& positions, const std:
 // scene object functions
 void setup();
 void gen_terrain();
+void continue_rebuild();
+void regenerate_noise();
+void swap_terrain();
+void gen_streamer();
+void tune_generator();
+void rebuild_generator(glm::ivec2 local_size);
 
 // matrix functions
 glm::mat4 get_view_projection_matrix();
@@ -34,6 +40,8 @@ void process_input(GLFWwindow* window);
 
 // gui functions
 void draw_gui();
+void run_benchmark(GLFWwindow* window, unsigned int frames);
+void render_terrain();
 
 // ----------------------------------------------------------------------------
 
@@ -46,16 +54,54 @@ float fov = 80.0f;
 
 // terrain settings
 unsigned int tex_w = 8192, tex_h = 8192, patch_res = 128;
+Terrain::DataFormat data_format = Terrain::PACKED;
+Terrain::PatchLayout patch_layout = Terrain::SHARED_GRID;
+bool quantized_vertices = true;
+// regenerating builds the new terrain across frames while the old one is still drawn, spending about
+// rebuild_budget_ms of every frame on it, and swaps the two once it is done
+bool async_rebuild = true;
+float rebuild_budget_ms = 4.0f;
+// changing a noise setting regenerates the map in place, a preview at once and the full resolution tiles within the
+// same per-frame budget
+bool live_regeneration = true;
+// the infinite world not drawn when the noise changed, regenerated when it is picked
+bool worlds_stale = false;
+// what gets drawn: the finite map, or one of the camera-centred infinite worlds
+enum WorldMode {
+    FINITE_MAP,
+    CLIPMAPS,
+    STREAMED_TILES
+};
+WorldMode world_mode = FINITE_MAP;
+unsigned int clipmap_levels = 6;
+unsigned int tile_cache_mib = 32;
+// generated maps are kept on disk, up to terrain_cache_mib, and loaded instead of generated when their settings come back
+bool use_terrain_cache = true;
+unsigned int terrain_cache_mib = 4096;
 
 // shaders
 Shader* terrain_shader;
+Shader* cdlod_shader;
+Shader* clipmap_shader;
+Shader* tile_shader;
 ComputeShader* generator_shader;
+// the generator the drawn terrain was built with, once a background rebuild with a new one started: the terrain may
+// still refine with it, so it is only deleted when swap_terrain() drops the terrain
+ComputeShader* retired_generator;
+WorkgroupTuner* generator_tuner;
+ComputeShader* bounds_shader;
+ComputeShader* roughness_shader;
+ComputeShader* tess_shader;
+TerrainCache* terrain_cache;
 
 // camera
 Camera* camera;
 
 // scene objects
 Terrain* terrain;
+Terrain* next_terrain;
+Clipmap* clipmap;
+TileStreamer* streamer;
 std::vector<SceneObject*> objects;
 
 NoiseSettings* noise;
@@ -66,8 +112,17 @@ float last_frame = 0.0f, delta_time = 0.0f;
 glm::vec3 click_start(0.0f), click_end(0.0f);
 // ----------------------------------------------------------------------------
 
-int main()
+int main(int argc, char** argv)
 {
+    unsigned int benchmark_frames = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--headless")
+            return run_headless(argc, argv);
+        // --benchmark [frames]: flies a fixed camera path with both renderers and exits
+        if (std::string(argv[i]) == "--benchmark")
+            benchmark_frames = i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0]) ? (unsigned int)std::strtoul(argv[++i], nullptr, 10) : 600;
+    }
+
     // standard setup as per class exercises
 
     // glfw window creation and setup
@@ -121,6 +176,8 @@ int main()
     // prepare scene
     camera = new Camera(glm::vec3(0.0f, 11.0f, 0.0f));
     setup();
+    if (benchmark_frames > 0)
+        run_benchmark(window, benchmark_frames);
 
     while (!glfwWindowShouldClose(window))
     {
@@ -135,10 +192,9 @@ int main()
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // wireframe mode
         else
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        if (terrain) {
-            terrain->set_uniforms(camera, get_view_projection_matrix());
-            terrain->draw();
-        }
+        continue_rebuild();
+        terrain_cache->update();
+        render_terrain();
         /*for (auto obj : objects) {
             obj->draw();
         }*/
@@ -150,9 +206,21 @@ int main()
     }
 
     delete terrain;
+    delete next_terrain;
+    delete clipmap;
+    delete streamer;
     delete terrain_shader;
+    delete cdlod_shader;
+    delete clipmap_shader;
+    delete tile_shader;
     delete generator_shader;
+    delete retired_generator;
+    delete generator_tuner;
+    delete bounds_shader;
+    delete roughness_shader;
+    delete tess_shader;
     delete noise;
+    delete terrain_cache;
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -184,15 +252,65 @@ void draw_gui() {
         ImGui::InputInt("Width", (int*)&tex_w, 16, 128);
         ImGui::InputInt("Height", (int*)&tex_h, 16, 128);
         ImGui::InputInt("Patch resolution", (int*)&patch_res, 1, 5);
-        ImGui::DragFloat3("Offset", (float*)&noise->offset, .1f, -10, 10);
-        ImGui::SliderFloat("Frequency", (float*)&noise->frequency, 0.0001f, 0.005f, "%.4f");
-        ImGui::DragInt("Octaves", (int*)&noise->octaves, 1.0f, 1.0f, 16.0f);
-        ImGui::SliderFloat("Amplitude", (float*)&noise->amplitude, 1.0f, 10.0f);
-        ImGui::SliderFloat("Lacunarity", (float*)&noise->lacunarity, 0.1f, 4.0f);
-        ImGui::SliderFloat("Gain", (float*)&noise->gain, 0.1f, 2.0f);
-        ImGui::SliderFloat("Range", (float*)&noise->range, 0.1f, 10.0f);
+        bool noise_changed = false;
+        // whole texels, so dragging the map around only generates the strips it uncovers
+        noise_changed |= ImGui::DragFloat2("Offset (texels)", (float*)&noise->offset, 1.0f, -100000.0f, 100000.0f, "%.0f");
+        noise_changed |= ImGui::DragFloat("Offset z", (float*)&noise->offset.z, .1f, -10, 10);
+        noise_changed |= ImGui::SliderFloat("Frequency", (float*)&noise->frequency, 0.0001f, 0.005f, "%.4f");
+        noise_changed |= ImGui::DragInt("Octaves", (int*)&noise->octaves, 1.0f, 1.0f, 16.0f);
+        noise_changed |= ImGui::SliderFloat("Amplitude", (float*)&noise->amplitude, 1.0f, 10.0f);
+        noise_changed |= ImGui::SliderFloat("Lacunarity", (float*)&noise->lacunarity, 0.1f, 4.0f);
+        noise_changed |= ImGui::SliderFloat("Gain", (float*)&noise->gain, 0.1f, 2.0f);
+        noise_changed |= ImGui::SliderFloat("Range", (float*)&noise->range, 0.1f, 10.0f);
+        noise_changed |= ImGui::Checkbox("Band-limit octaves", &noise->band_limit);
+        ImGui::Text("Biome settings: ");
+        noise_changed |= ImGui::SliderFloat("Biome frequency", (float*)&noise->biome_frequency, 0.0001f, 0.005f, "%.4f");
+        noise_changed |= ImGui::DragInt("Biome octaves", (int*)&noise->biome_octaves, 1.0f, 1.0f, 16.0f);
+        noise_changed |= ImGui::SliderFloat("Biome amplitude", (float*)&noise->biome_amplitude, 1.0f, 10.0f);
+        noise_changed |= ImGui::SliderFloat("Biome lacunarity", (float*)&noise->biome_lacunarity, 0.1f, 4.0f);
+        noise_changed |= ImGui::SliderFloat("Biome gain", (float*)&noise->biome_gain, 0.1f, 2.0f);
+        noise_changed |= ImGui::SliderFloat("Biome range", (float*)&noise->biome_range, 0.1f, 10.0f);
+        if (noise_changed && live_regeneration)
+            regenerate_noise();
         if (ImGui::Button("Regenerate terrain"))
             gen_terrain();
+        ImGui::Checkbox("Regenerate on changes", &live_regeneration);
+        ImGui::Checkbox("Rebuild in the background", &async_rebuild);
+        ImGui::SliderFloat("Rebuild budget (ms/frame)", &rebuild_budget_ms, 0.5f, 16.0f);
+        if (next_terrain != nullptr) {
+            ImGui::ProgressBar(next_terrain->get_build_progress());
+            ImGui::Text("Rebuilding: %u frames, %.1f ms so far", next_terrain->get_build_frames(), next_terrain->get_build_time());
+        }
+        if (!terrain->is_refined()) {
+            ImGui::ProgressBar(terrain->get_refine_progress());
+            ImGui::Text("Refining: %.3f ms per %u texel tile", terrain->get_refine_tile_time(), Terrain::REFINE_TILE_SIZE);
+        }
+        glm::ivec3 local_size = generator_shader->getLocalSize();
+        ImGui::Text("Generator work group: %dx%d%s", local_size.x, local_size.y, generator_tuner->is_tuned() ? " (tuned)" : "");
+        if (ImGui::Button("Autotune generator"))
+            tune_generator();
+        bool packed_storage = data_format == Terrain::PACKED;
+        if (ImGui::Checkbox("Packed storage", &packed_storage)) {
+            data_format = packed_storage ? Terrain::PACKED : Terrain::FULL;
+            glm::ivec3 size = generator_shader->getLocalSize();
+            rebuild_generator(glm::ivec2(size.x, size.y));
+        }
+        ImGui::Text("Terrain data: %zu MiB", terrain->get_data_size() / (1024 * 1024));
+        if (ImGui::Checkbox("Use terrain cache", &use_terrain_cache)) {
+            terrain->set_cache(use_terrain_cache ? terrain_cache : nullptr);
+            if (next_terrain != nullptr)
+                next_terrain->set_cache(use_terrain_cache ? terrain_cache : nullptr);
+        }
+        if (ImGui::InputInt("Cache limit (MiB)", (int*)&terrain_cache_mib, 256, 1024))
+            terrain_cache->max_bytes = (uint64_t)std::max(terrain_cache_mib, 1u) * 1024 * 1024;
+        ImGui::Text("Terrain cache: %u maps, %llu MiB, %u being stored", terrain_cache->get_num_entries(), (unsigned long long)(terrain_cache->get_size() / (1024 * 1024)), terrain_cache->get_num_pending());
+        if (ImGui::Button("Clear terrain cache"))
+            terrain_cache->clear();
+        if (ImGui::Combo("Patch layout", (int*)&patch_layout, "Separate patches\0Shared grid\0Procedural\0"))
+            terrain->set_patch_layout(patch_layout);
+        if (ImGui::Checkbox("Quantized vertices", &quantized_vertices))
+            terrain->set_vertex_format(quantized_vertices ? Terrain::QUANTIZED_VERTICES : Terrain::FLOAT_VERTICES);
+        ImGui::Text("Patch buffers: %zu KiB", terrain->get_patch_buffer_size() / 1024);
         ImGui::Separator();
 
         ImGui::Text("Tessellation settings: ");
@@ -200,10 +318,44 @@ void draw_gui() {
         ImGui::InputInt("Max tessellation level", (int*)&terrain->max_tess_level, 1, 5);
         ImGui::InputFloat("Min distance", (float*)&terrain->min_distance, 1.0f, 10.0f);
         ImGui::InputFloat("Max distance", (float*)&terrain->max_distance, 1.0f, 10.0f);
+        ImGui::Checkbox("Screen-space error metric", &terrain->screen_space_error);
+        ImGui::SliderFloat("Pixel error", &terrain->pixel_error, 0.1f, 8.0f);
+        ImGui::Text("Triangles: %llu", (unsigned long long)terrain->get_triangles());
         ImGui::Separator();
 
         ImGui::Text("Visualization: ");
         ImGui::Checkbox("Toggle wireframe", &toggle_wireframe);
+        ImGui::Combo("Renderer", (int*)&terrain->render_mode, "Tessellation\0CDLOD\0");
+        ImGui::Checkbox("Lighting", &terrain->lighting);
+        if (ImGui::Combo("World", (int*)&world_mode, "Finite map\0Geometry clipmaps\0Streamed tiles\0") && worlds_stale) {
+            delete clipmap;
+            clipmap = new Clipmap(clipmap_levels, clipmap_shader, generator_shader, *noise, data_format);
+            gen_streamer();
+            worlds_stale = false;
+        }
+        if (world_mode == CLIPMAPS)
+            ImGui::Text("Clipmap: %u levels over %u texels, %zu KiB, %zu samples updated", clipmap->get_num_levels(), clipmap->get_extent(), clipmap->get_data_size() / 1024, clipmap->get_updated_samples());
+        if (world_mode == STREAMED_TILES) {
+            ImGui::SliderInt("Tile ring radius", &streamer->ring_radius, 1, 12);
+            ImGui::InputInt("Tile uploads per frame", (int*)&streamer->upload_budget, 1, 4);
+            if (ImGui::InputInt("Tile cache (MiB)", (int*)&tile_cache_mib, 8, 64)) {
+                tile_cache_mib = std::max(tile_cache_mib, 1u);
+                gen_streamer();
+            }
+            ImGui::Text("Tiles: %u drawn, %u / %u resident, %u pending, %u uploaded", streamer->get_num_drawn(), streamer->get_num_resident(), streamer->get_capacity(), streamer->get_num_pending(), streamer->get_uploads());
+            ImGui::Text("Requested %zu, evicted %zu, dropped %zu, %u missing on screen", streamer->get_requested_tiles(), streamer->get_evicted_tiles(), streamer->get_dropped_tiles(), streamer->get_num_missing());
+            ImGui::SliderInt("Prefetch frames", &streamer->prefetch_frames, 0, 240);
+            ImGui::Text("Prefetch: %u predicted, %zu requested, %zu hits, %zu late, %zu wasted, %zu on demand", streamer->get_num_predicted(), streamer->get_prefetched_tiles(), streamer->get_prefetch_hits(), streamer->get_prefetch_late(), streamer->get_wasted_prefetches(), streamer->get_demand_tiles());
+        }
+        ImGui::Combo("Frustum culling", (int*)&terrain->culling, "None\0Flat\0Quadtree\0Pre-pass (GPU)\0");
+        if (terrain->render_mode == Terrain::CDLOD) {
+            ImGui::SliderFloat("LOD distance", &terrain->lod_distance, 16.0f, 2048.0f);
+            ImGui::SliderFloat("Morph start", &terrain->morph_start, 0.1f, 0.95f);
+            ImGui::InputInt("Triangle budget", (int*)&terrain->triangle_budget, 10000, 100000);
+            ImGui::Text("Nodes: %u, %llu triangles, ranges x%.2f, selected in %.3f ms", terrain->get_num_lod_nodes(), (unsigned long long)terrain->get_lod_triangles(), terrain->get_lod_range_scale(), terrain->get_culling_time());
+        }
+        else
+            ImGui::Text("Visible patches: %u / %u, culled in %.3f ms", terrain->get_num_visible_patches(), terrain->get_num_patches(), terrain->get_culling_time());
       
         ImGui::Separator();
 
@@ -220,15 +372,102 @@ void draw_gui() {
 void setup() {
     // initialize shaders
     terrain_shader = new Shader("shaders/shader.vert", "shaders/shader.frag", nullptr, "shaders/terrain_lod.tesc", "shaders/terrain_lod.tese");
-    generator_shader = new ComputeShader("shaders/terrain_gen.comp");
-    noise = new NoiseSettings(glm::vec3(0), 0.0025f, 8, 4.0f, 2.0f, 0.575f, 0.65f);
+    cdlod_shader = new Shader("shaders/cdlod.vert", "shaders/shader.frag");
+    clipmap_shader = new Shader("shaders/clipmap.vert", "shaders/shader.frag");
+    tile_shader = new Shader("shaders/tile.vert", "shaders/shader.frag");
+    generator_tuner = new WorkgroupTuner("shaders/terrain_gen.comp", "workgroup_cache.txt");
+    generator_shader = generator_tuner->create_generator(generator_tuner->get_local_size(), data_format);
+    bounds_shader = new ComputeShader("shaders/terrain_minmax.comp");
+    roughness_shader = new ComputeShader("shaders/terrain_roughness.comp");
+    tess_shader = new ComputeShader("shaders/terrain_tess.comp");
+    noise = new NoiseSettings(NoiseSettings::defaults());
+    terrain_cache = new TerrainCache("terrain_cache", "shaders/terrain_gen.comp", (uint64_t)terrain_cache_mib * 1024 * 1024);
     gen_terrain();
 }
 
 void gen_terrain() {
+    // the first terrain is built on the spot, there is nothing to draw meanwhile; a rebuild already running starts over
+    bool deferred = async_rebuild && terrain != nullptr;
+    if (next_terrain != nullptr)
+        delete next_terrain;
+    // the data the current terrain has in common with the new one is copied over rather than generated again
+    next_terrain = new Terrain(tex_w, tex_h, patch_res, terrain_shader, cdlod_shader, generator_shader, bounds_shader, roughness_shader, tess_shader, *noise, data_format, deferred, terrain, use_terrain_cache ? terrain_cache : nullptr);
+    if (!deferred)
+        swap_terrain();
+    if (clipmap != nullptr)
+        delete clipmap;
+    clipmap = new Clipmap(clipmap_levels, clipmap_shader, generator_shader, *noise, data_format);
+    gen_streamer();
+    worlds_stale = false;
+}
+
+void regenerate_noise() {
+    // the map keeps its size, so it turns around in place; the infinite worlds start over, the one not drawn only once
+    // it is picked
+    terrain->regenerate(*noise);
+    if (next_terrain != nullptr)
+        next_terrain->regenerate(*noise);
+    if (world_mode == CLIPMAPS) {
+        delete clipmap;
+        clipmap = new Clipmap(clipmap_levels, clipmap_shader, generator_shader, *noise, data_format);
+    }
+    else if (world_mode == STREAMED_TILES)
+        gen_streamer();
+    worlds_stale = true;
+}
+
+void continue_rebuild() {
+    if (next_terrain != nullptr && next_terrain->build(rebuild_budget_ms))
+        swap_terrain();
+    if (terrain != nullptr)
+        terrain->refine(camera->position, rebuild_budget_ms);
+}
+
+void swap_terrain() {
+    Terrain::RenderMode render_mode = terrain ? terrain->render_mode : Terrain::TESSELLATION;
+    bool lighting = terrain ? terrain->lighting : true;
     if (terrain != nullptr)
         delete terrain;
-    terrain = new Terrain(tex_w, tex_h, patch_res, terrain_shader, generator_shader, *noise);
+    if (retired_generator != nullptr) {
+        glDeleteProgram(retired_generator->ID);
+        delete retired_generator;
+        retired_generator = nullptr;
+    }
+    terrain = next_terrain;
+    next_terrain = nullptr;
+    terrain->render_mode = render_mode;
+    terrain->lighting = lighting;
+    terrain->set_patch_layout(patch_layout);
+    terrain->set_vertex_format(quantized_vertices ? Terrain::QUANTIZED_VERTICES : Terrain::FLOAT_VERTICES);
+}
+
+void gen_streamer() {
+    int ring_radius = streamer ? streamer->ring_radius : 4;
+    unsigned int upload_budget = streamer ? streamer->upload_budget : 2;
+    int prefetch_frames = streamer ? streamer->prefetch_frames : 90;
+    if (streamer != nullptr)
+        delete streamer;
+    streamer = new TileStreamer(tile_shader, *noise, (size_t)tile_cache_mib * 1024 * 1024);
+    streamer->ring_radius = ring_radius;
+    streamer->upload_budget = upload_budget;
+    streamer->prefetch_frames = prefetch_frames;
+}
+
+void tune_generator() {
+    rebuild_generator(generator_tuner->tune(*noise, data_format));
+}
+
+void rebuild_generator(glm::ivec2 local_size) {
+    // a background rebuild leaves the current terrain drawn and refining with its generator (compiled for its data
+    // format) until the swap; only one generator is ever retired, a later one was only used by the rebuild restarted here
+    if (async_rebuild && terrain != nullptr && retired_generator == nullptr)
+        retired_generator = generator_shader;
+    else {
+        glDeleteProgram(generator_shader->ID);
+        delete generator_shader;
+    }
+    generator_shader = generator_tuner->create_generator(local_size, data_format);
+    gen_terrain();
 }
 
 glm::mat4 get_view_projection_matrix() {
@@ -242,6 +481,113 @@ glm::mat4 get_view_projection_matrix() {
         return projection * view;
 }
 
+void render_terrain() {
+    if (!terrain)
+        return;
+    glm::mat4 view_projection = get_view_projection_matrix();
+    if (world_mode == STREAMED_TILES) {
+        streamer->height_scale = terrain->height_scale;
+        streamer->height_shift = terrain->height_shift;
+        streamer->update(view_projection, camera->position, camera->forward);
+        streamer->set_uniforms(camera, view_projection);
+        streamer->draw();
+        return;
+    }
+    if (world_mode == CLIPMAPS) {
+        clipmap->height_scale = terrain->height_scale;
+        clipmap->height_shift = terrain->height_shift;
+        clipmap->update(camera->position);
+        clipmap->set_uniforms(camera, view_projection);
+        clipmap->draw();
+        return;
+    }
+    terrain->cull(view_projection, camera->position);
+    terrain->set_uniforms(camera, view_projection);
+    terrain->draw();
+}
+
+void run_benchmark(GLFWwindow* window, unsigned int frames) {
+    // the same path for every renderer: one loop around the terrain center at a fixed height, looking along the path
+    // and slightly down
+    glfwSwapInterval(0);
+    glm::vec3 start_position = camera->position;
+    float radius = 0.3f * std::min(tex_w, tex_h);
+    const char* names[] = { "Tessellation", "CDLOD" };
+    auto timed_frame = [window]() {
+        auto begin = std::chrono::steady_clock::now();
+        glClearColor(0.0f, 0.0f, 0.2f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        render_terrain();
+        glfwSwapBuffers(window);
+        glFinish();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+        glfwPollEvents();
+        return elapsed.count();
+    };
+    for (auto mode : { Terrain::TESSELLATION, Terrain::CDLOD }) {
+        terrain->render_mode = mode;
+        std::vector<double> frame_ms;
+        double culling_ms = 0.0;
+        GLuint64 triangles = 0;
+        for (unsigned int frame = 0; frame < frames; frame++) {
+            float angle = 2.0f * (float)M_PI * frame / frames;
+            camera->position = glm::vec3(radius * std::cos(angle), 0.75f * terrain->height_scale, radius * std::sin(angle));
+            camera->yaw = glm::degrees(angle) + 90.0f;
+            camera->pitch = -15.0f;
+            camera->process_cursor_input(0.0f, 0.0f);
+
+            frame_ms.push_back(timed_frame());
+            culling_ms += terrain->get_culling_time();
+            // the count of the previous frame, the query is read a frame late
+            triangles += terrain->get_triangles();
+        }
+        std::sort(frame_ms.begin(), frame_ms.end());
+        double total_ms = 0.0;
+        for (double ms : frame_ms)
+            total_ms += ms;
+        std::cout << names[mode] << ": " << total_ms / frames << " ms/frame (median " << frame_ms[frames / 2] << ", 95th percentile "
+            << frame_ms[frames * 95 / 100] << "), " << triangles / frames << " triangles/frame, CPU culling/selection "
+            << culling_ms / frames << " ms/frame" << std::endl;
+    }
+    terrain->render_mode = Terrain::TESSELLATION;
+
+    // streamed tiles: a wide turn at the camera speed and 60 frames per second, far past the finite map, without and
+    // with prefetching; the frame times of the first and the second half of each flight should match
+    WorldMode start_mode = world_mode;
+    int start_prefetch = streamer->prefetch_frames;
+    world_mode = STREAMED_TILES;
+    for (int prefetch_frames : { 0, std::max(start_prefetch, 1) }) {
+        gen_streamer();
+        streamer->prefetch_frames = prefetch_frames;
+        std::vector<double> frame_ms;
+        size_t missing = 0;
+        const float turn_radius = 4000.0f;
+        for (unsigned int frame = 0; frame < frames; frame++) {
+            float angle = frame * camera->speed / 60.0f / turn_radius;
+            camera->position = glm::vec3(turn_radius * std::sin(angle), 0.75f * terrain->height_scale, turn_radius * (1.0f - std::cos(angle)));
+            camera->yaw = glm::degrees(angle);
+            camera->pitch = -15.0f;
+            camera->process_cursor_input(0.0f, 0.0f);
+            frame_ms.push_back(timed_frame());
+            missing += streamer->get_num_missing();
+        }
+        double half_ms[2] = { 0.0, 0.0 };
+        for (unsigned int frame = 0; frame < frames; frame++)
+            half_ms[frame * 2 / frames] += frame_ms[frame];
+        std::sort(frame_ms.begin(), frame_ms.end());
+        std::cout << "Streamed tiles over " << (unsigned int)(frames * camera->speed / 60.0f) << " texels, prefetching " << prefetch_frames
+            << " frames: " << half_ms[0] / (frames / 2) << " / " << half_ms[1] / (frames - frames / 2) << " ms/frame (first / second half), 95th percentile "
+            << frame_ms[frames * 95 / 100] << ", max " << frame_ms.back() << "; " << missing << " missing tile-frames, "
+            << streamer->get_demand_tiles() << " tiles on demand, " << streamer->get_prefetched_tiles() << " prefetched ("
+            << streamer->get_prefetch_hits() << " hits, " << streamer->get_prefetch_late() << " late, " << streamer->get_wasted_prefetches() << " wasted), "
+            << streamer->get_evicted_tiles() << " evicted" << std::endl;
+    }
+    streamer->prefetch_frames = start_prefetch;
+    world_mode = start_mode;
+    camera->position = start_position;
+    glfwSetWindowShouldClose(window, true);
+}
+
 unsigned int create_vertex_array(const std::vector<float>& positions, const std::vector<float>& colors, const std::vector<unsigned int>& indices) {
     unsigned int VAO;
     glGenVertexArrays(1, &VAO);
@@ -8,6 +8,9 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <math.h>
 #include <iostream>
 
@@ -29,5 +32,10 @@
 #include "engine/compute_shader.h"
 #include "engine/camera.h"
 #include "engine/terrain.h"
+#include "engine/terrain_cache.h"
+#include "engine/clipmap.h"
+#include "engine/tile_streamer.h"
+#include "engine/workgroup_tuner.h"
+#include "headless.h"
 
 // TODO: Reference additional headers your program requires here.
@@ -0,0 +1,61 @@
+#version 430 core
+// CDLOD (continuous distance-dependent LOD) terrain vertex shader, the alternative to the tessellation stages.
+// Every selected quadtree node draws one instance of the same grid_size x grid_size grid mesh over its area. Inside
+// the morph range of its level a vertex slides towards the grid of the next coarser level, odd vertices onto their even
+// neighbour, so at the end of the range the node matches the coarser nodes around it and the levels blend without cracks.
+
+// mesh corner (i, j) in [0, grid_size]
+layout (location = 0) in vec2 v_grid;
+// per instance: uv of the node origin, uv size of the node, quadtree level
+layout (location = 1) in vec4 v_node;
+
+out float height;
+out float moist;
+out float other;
+out vec3 normal;
+
+uniform mat4 model;
+uniform float height_scale;
+uniform float height_shift;
+uniform sampler2D terrain_data;
+// packed storage keeps moisture and detail in a separate RG8 texture, otherwise they are the .yz of terrain_data
+uniform sampler2D biome_data;
+uniform bool packed_data;
+// (dh/dx, dh/dy) per texel of the height
+uniform sampler2D slope_data;
+// world xz = uv * patch_scale + patch_offset, as in shader.vert
+uniform vec2 patch_scale;
+uniform vec2 patch_offset;
+
+uniform int grid_size;
+uniform vec3 eye;
+// (start, end) distance of the morph of every level, see Terrain::set_cdlod_uniforms
+#define MAX_LOD_LEVELS 16
+uniform vec2 morph_ranges[MAX_LOD_LEVELS];
+
+// nodes of a non power of two grid can stick out of the terrain, their outer vertices collapse onto its edge
+vec2 node_uv(vec2 grid) { return min(v_node.xy + grid / float(grid_size) * v_node.z, vec2(1.0)); }
+
+vec3 world_position(vec2 uv, float h) {
+	vec2 xz = uv * patch_scale + patch_offset;
+	return vec3(xz.x, h * height_scale - height_shift, xz.y);
+}
+
+void main()
+{
+	vec2 uv = node_uv(v_grid);
+	float dist = distance(eye, world_position(uv, textureLod(terrain_data, uv, 0.0).x));
+	vec2 morph = morph_ranges[int(v_node.w)];
+	float k = clamp((dist - morph.x) / (morph.y - morph.x), 0.0, 1.0);
+	uv = node_uv(v_grid - fract(v_grid * 0.5) * 2.0 * k);
+
+	vec4 data = textureLod(terrain_data, uv, 0.0);
+	vec2 biome = packed_data ? textureLod(biome_data, uv, 0.0).xy : data.yz;
+	height = data.x;
+	moist = biome.x;
+	other = biome.y;
+	// slope in world units, as in terrain_lod.tese
+	vec2 slope = textureLod(slope_data, uv, 0.0).xy * height_scale * vec2(textureSize(slope_data, 0)) / patch_scale;
+	normal = normalize(vec3(-slope.x, 1.0, -slope.y));
+	gl_Position = model * vec4(world_position(uv, height), 1.0);
+}
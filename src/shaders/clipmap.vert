@@ -0,0 +1,65 @@
+#version 430 core
+// Geometry clipmap vertex shader, see engine/clipmap.h.
+// Sample s of a level sits at world xz = s * level_spacing and is stored at texel s mod texture_size of the level
+// textures. Towards the outer border of its window a level blends into the heights of the next coarser level, fully at
+// the border itself, where the odd vertices then lie on the coarse edges the next level draws.
+
+// window corner (i, j) in [0, grid_size]
+layout (location = 0) in vec2 v_grid;
+
+out float height;
+out float moist;
+out float other;
+// no slopes are generated here, the surface is drawn unlit (see shader.frag)
+out vec3 normal;
+
+uniform mat4 model;
+uniform float height_scale;
+uniform float height_shift;
+uniform sampler2D terrain_data;
+// packed storage keeps moisture and detail in a separate RG8 texture, otherwise they are the .yz of terrain_data
+uniform sampler2D biome_data;
+uniform bool packed_data;
+// heights of the next coarser level
+uniform sampler2D coarse_data;
+uniform bool blend_coarse;
+
+uniform int grid_size;
+uniform int texture_size;
+// window corner in samples of the level, texels between two samples
+uniform ivec2 level_origin;
+uniform int level_spacing;
+// eye xz in samples of the level
+uniform vec2 eye_samples;
+
+ivec2 wrap(ivec2 s) { return ivec2(mod(vec2(s), float(texture_size))); }
+
+// height of the coarse surface at fine sample s: the coarse sample, or the mean of the two (four) around an odd one
+float coarse_height(ivec2 s) {
+	ivec2 c = ivec2(floor(vec2(s) * 0.5));
+	ivec2 odd = s - 2 * c;
+	return (texelFetch(coarse_data, wrap(c), 0).x + texelFetch(coarse_data, wrap(c + ivec2(odd.x, 0)), 0).x
+		+ texelFetch(coarse_data, wrap(c + ivec2(0, odd.y)), 0).x + texelFetch(coarse_data, wrap(c + odd), 0).x) * 0.25;
+}
+
+void main()
+{
+	ivec2 s = level_origin + ivec2(v_grid);
+	vec4 data = texelFetch(terrain_data, wrap(s), 0);
+	vec2 biome = packed_data ? texelFetch(biome_data, wrap(s), 0).xy : data.yz;
+	height = data.x;
+	moist = biome.x;
+	other = biome.y;
+	normal = vec3(0.0, 1.0, 0.0);
+
+	if (blend_coarse) {
+		// the window borders are more than grid_size / 2 - 2 samples from the eye, so they always get alpha 1
+		vec2 d = abs(vec2(s) - eye_samples);
+		float transition = float(grid_size) / 10.0;
+		float alpha = clamp((max(d.x, d.y) - (float(grid_size) / 2.0 - 2.0 - transition)) / transition, 0.0, 1.0);
+		height = mix(height, coarse_height(s), alpha);
+	}
+
+	vec2 xz = vec2(s * level_spacing);
+	gl_Position = model * vec4(xz.x, height * height_scale - height_shift, xz.y, 1.0);
+}
@@ -5,6 +5,11 @@ uniform float height_shift;
 in float height;
 in float moist;
 in float other;
+in vec3 normal;
+// diffuse lighting by the interpolated normal, only set for the renderers with generated slopes
+uniform bool lighting = false;
+const vec3 light_direction = normalize(vec3(-0.5, 1.0, 0.3));
+const float ambient = 0.35;
 
 out vec4 FragColor;
 
@@ -45,6 +50,8 @@ vec4 pick_color() {
 void main()
 {
 	vec4 color = pick_color();
+	if (lighting)
+		color.rgb *= ambient + (1.0 - ambient) * max(dot(normalize(normal), light_direction), 0.0);
     FragColor = color - vec4(vec3(other / 4.0), 0.0);
 //	FragColor = vec4(vec3(moist), 1.0);
 }
\ No newline at end of file
@@ -2,12 +2,35 @@
 
 layout (location = 0) in vec3 v_pos;
 layout (location = 1) in vec2 v_tex;
+// Terrain::QUANTIZED_VERTICES: the integer grid corner (i, j) instead of v_pos and v_tex
+layout (location = 2) in vec2 v_grid;
 out vec2 v_tex_coord;
 
 uniform mat4 model;
 
+// Terrain::PROCEDURAL: no vertex buffer, vertex 4 * p + k is corner k of patch p = i * resolution + j
+uniform bool procedural_patches;
+uniform bool quantized_vertices;
+uniform int resolution;
+// world xz = uv * patch_scale + patch_offset
+uniform vec2 patch_scale;
+uniform vec2 patch_offset;
+
 void main()
 {
-    gl_Position = vec4(v_pos, 1.0);
-	v_tex_coord = v_tex;
-}
\ No newline at end of file
+    vec2 corner;
+    if (procedural_patches) {
+        int patch_index = gl_VertexID >> 2;
+        corner = vec2(ivec2(patch_index / resolution, patch_index % resolution) + ivec2(gl_VertexID & 1, (gl_VertexID >> 1) & 1));
+    }
+    else if (quantized_vertices)
+        corner = v_grid;
+    else {
+        gl_Position = vec4(v_pos, 1.0);
+        v_tex_coord = v_tex;
+        return;
+    }
+    v_tex_coord = corner / float(resolution);
+    vec2 xz = v_tex_coord * patch_scale + patch_offset;
+    gl_Position = vec4(xz.x, 0.0, xz.y, 1.0);
+}
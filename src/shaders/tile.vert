@@ -0,0 +1,35 @@
+#version 430 core
+// Streamed tile vertex shader, see engine/tile_streamer.h.
+// One instance per tile: corner (i, j) of the tile grid sits at world xz = tile * tile_size + (i, j) and reads sample
+// (i, j) of the tile's layer in the texture arrays.
+
+// tile corner (i, j) in [0, tile_size]
+layout (location = 0) in vec2 v_grid;
+// tile coordinates and array layer
+layout (location = 1) in ivec4 v_tile;
+
+out float height;
+out float moist;
+out float other;
+// no slopes are generated here, the surface is drawn unlit (see shader.frag)
+out vec3 normal;
+
+uniform mat4 model;
+uniform float height_scale;
+uniform float height_shift;
+uniform sampler2DArray height_data;
+uniform sampler2DArray biome_data;
+uniform int tile_size;
+
+void main()
+{
+	ivec3 texel = ivec3(ivec2(v_grid), v_tile.z);
+	height = texelFetch(height_data, texel, 0).x;
+	vec2 biome = texelFetch(biome_data, texel, 0).xy;
+	moist = biome.x;
+	other = biome.y;
+	normal = vec3(0.0, 1.0, 0.0);
+
+	vec2 xz = vec2(v_tile.xy * tile_size) + v_grid;
+	gl_Position = model * vec4(xz.x, height * height_scale - height_shift, xz.y, 1.0);
+}
@@ -2,11 +2,14 @@
 #include <glm/glm.hpp>
 #include <algorithm>
 #include <vector>
+#include <cfloat>
+#include <cmath>
 
 #include "plane.h"
 
 // Adapted from https://github.com/fstrugar/CDLOD/blob/master/source/BasicCDLOD/MiniMath.h
 class AABB {
+public:
     enum IntersectionType {
         INSIDE,
         INTERSECT,
@@ -16,13 +19,13 @@ class AABB {
     glm::vec3 min;
     glm::vec3 max;
 
+    AABB() : min(0.0f), max(0.0f) {}
     AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
 
-    glm::vec3 get_center() { return (min + max) * 0.5f; }
-    glm::vec3 get_extents() { return max - get_center(); }
-    glm::vec3 get_size() { return max - min; }
-    glm::vec3* get_corners() {
-        glm::vec3 corners[8];
+    glm::vec3 get_center() const { return (min + max) * 0.5f; }
+    glm::vec3 get_extents() const { return max - get_center(); }
+    glm::vec3 get_size() const { return max - min; }
+    void get_corners(glm::vec3 corners[8]) const {
         corners[0] = glm::vec3(min.x, min.y, min.z);
         corners[1] = glm::vec3(min.x, max.y, min.z);
         corners[2] = glm::vec3(max.x, min.y, min.z);
@@ -31,7 +34,6 @@ class AABB {
         corners[5] = glm::vec3(min.x, max.y, max.z);
         corners[6] = glm::vec3(max.x, min.y, max.z);
         corners[7] = glm::vec3(max.x, max.y, max.z);
-        return corners;
     }
 
     glm::vec3 get_positive(const glm::vec3& normal) {
@@ -58,11 +60,11 @@ class AABB {
 
     float min_squared_distance(const glm::vec3 & point) {
         float dist = 0.0f, k = 0.0f;
-        k = (point.x < min.x) ? point.x - min.x : point.x - max.x;
+        k = (point.x < min.x) ? point.x - min.x : (point.x > max.x ? point.x - max.x : 0.0f);
         dist += k * k;
-        k = (point.y < min.y) ? point.y - min.y : point.y - max.y;
+        k = (point.y < min.y) ? point.y - min.y : (point.y > max.y ? point.y - max.y : 0.0f);
         dist += k * k;
-        k = (point.z < min.x) ? point.z - min.z : point.z - max.z;
+        k = (point.z < min.z) ? point.z - min.z : (point.z > max.z ? point.z - max.z : 0.0f);
         dist += k * k;
         return dist;
     }
@@ -81,7 +83,7 @@ class AABB {
 
     bool test_contains_point(const glm::vec3& point) {
         return (min.x <= point.x && max.x >= point.x) &&
-               (min.y <= point.x && max.y >= point.y) &&
+               (min.y <= point.y && max.y >= point.y) &&
                (min.z <= point.z && max.z >= point.z);
     }
 
@@ -95,39 +97,19 @@ class AABB {
 
 
 
+    // conservative box/plane test: the box is outside as soon as its corner furthest along a plane's normal is behind
+    // it, and inside once even the nearest corner is in front of every plane; a box near a frustum corner can be behind
+    // no single plane while outside all of them, and is then reported as intersecting
     IntersectionType test_frustum(const std::vector<Plane*>& frustum_planes) {
-        glm::vec3 center = get_center();
-        glm::vec3 size = get_size();
-        glm::vec3* corners = get_corners();
-        float size_l = glm::length(size);
-
-        // check bounding sphere against all planes
-        for (auto plane : frustum_planes) {
-            float dist_center = plane->distance(center);
-            if (dist_center < -size_l / 2.0f)
-                return OUTSIDE;
-        }
-
-        int inside_count = 0;
-        size_l /= 6.0f; // for some reason this makes the test more precise
+        IntersectionType result = INSIDE;
         for (auto plane : frustum_planes) {
-            int points_in = 9;
-            int front = 1;
-            for (int i = 0; i < 9; ++i) {
-                glm::vec3 point = (i == 8) ? center : corners[i];
-                float dist = plane->distance(point);
-                if (dist < -size_l) {
-                    front = 0;
-                    points_in--;
-                }
-            }
-            // if all points were outside the plane, its not inside the frustum
-            if (points_in == 0)
+            glm::vec3 normal = plane->get_normal();
+            if (plane->distance(get_positive(normal)) < 0.0f)
                 return OUTSIDE;
-            // if all points were in front of the plane
-            inside_count += front;
+            if (plane->distance(get_negative(normal)) < 0.0f)
+                result = INTERSECT;
         }
-        return (inside_count == 6) ? INSIDE : INTERSECT;
+        return result;
     }
 
     bool test_intersects_ray(const glm::vec3& ray_origin, const glm::vec3& ray_direction, float& distance) {
@@ -166,10 +148,10 @@ class AABB {
     void expand(const glm::vec3& point) {
         max.x = std::max(point.x, max.x);
         max.y = std::max(point.y, max.y);
-        max.z = std::max(point.y, max.y);
+        max.z = std::max(point.z, max.z);
         min.x = std::min(point.x, min.x);
         min.y = std::min(point.y, min.y);
-        min.z = std::min(point.y, min.y);
+        min.z = std::min(point.z, min.z);
     }
 
     void expand(float percentage) {
@@ -271,7 +253,7 @@ class AABB {
         return AABB(r_min, r_max);
     }
 
-    bool operator == (const AABB& b)
+    bool operator == (const AABB& b) const
     {
         return min == b.min && max == b.max;
     }
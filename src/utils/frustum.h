@@ -0,0 +1,42 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_access.hpp>
+#include <vector>
+
+#include "plane.h"
+
+// View frustum extracted from a view-projection matrix (Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes
+// from the World-View-Projection Matrix"), for OpenGL's [-1, 1] clip space depth.
+class Frustum {
+public:
+	static const int NUM_PLANES = 6;
+
+	// left, right, bottom, top, near, far as (normal, d) with the normal normalized and pointing inside:
+	// a point p is inside a plane when dot(normal, p) + d >= 0
+	glm::vec4 planes[NUM_PLANES];
+
+	explicit Frustum(const glm::mat4& view_projection) {
+		glm::vec4 row_x = glm::row(view_projection, 0);
+		glm::vec4 row_y = glm::row(view_projection, 1);
+		glm::vec4 row_z = glm::row(view_projection, 2);
+		glm::vec4 row_w = glm::row(view_projection, 3);
+		planes[0] = row_w + row_x;
+		planes[1] = row_w - row_x;
+		planes[2] = row_w + row_y;
+		planes[3] = row_w - row_y;
+		planes[4] = row_w + row_z;
+		planes[5] = row_w - row_z;
+		for (auto& plane : planes)
+			plane /= glm::length(glm::vec3(plane));
+	}
+
+	// the same planes in point-normal form, e.g. for AABB::test_frustum
+	std::vector<Plane> get_planes() const {
+		std::vector<Plane> result;
+		for (auto& plane : planes) {
+			glm::vec3 normal(plane);
+			result.emplace_back(-plane.w * normal, normal);
+		}
+		return result;
+	}
+};